@@ -1,24 +1,76 @@
+#define _GNU_SOURCE
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <pthread.h>
 
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
 #define TABLE_MAX_PAGES 100
 #define INVALID_PAGE_NUM UINT32_MAX
+#define TREE_MAX_HEIGHT 16
+#define MAX_SNAPSHOT_READERS 16
+#define BACKUP_CHUNK_PAGES 32
+#define WARM_CHUNK_PAGES 32
+#define HOT_PAGES_MAGIC 0x50544F48
+#define MEMTABLE_MAX_HEIGHT 12
+#define MEMTABLE_MAX_ROWS 256
+#define MAX_IN_KEYS 1024
+#define MAX_PARTITIONS 64
+#define PARTITION_MAGIC 0x50424458
+#define DEFAULT_FILL_PERCENT 90
+#define SCHEMA_MAX_COLUMNS 16
+#define SCHEMA_NAME_SIZE 16
+
+
+// 每行占用的定长空间由表结构决定（见 schema_row_size），最初的 (id, username, email) 表是 293 字节。
+// 行宽不超过 MAX_ROW_SIZE，叶节点至少放得下 3 行
+#define MAX_ROW_SIZE 1024
+
+// 一行的存储格式：各列按表结构中的偏移定长存放，与页内的值相同
+typedef struct {
+    uint8_t data[MAX_ROW_SIZE];
+} Row;
 
+// 列类型，每种类型一组编解码函数（见 TYPE_CODECS）
+typedef enum {
+    TYPE_INT,     // int：4 字节有符号整数
+    TYPE_FLOAT,   // float：8 字节双精度浮点数
+    TYPE_CHAR,    // char(n)：定长 n 字节，不足以 '\0' 填充
+    TYPE_VARCHAR  // varchar(n)：最多 n 字节，以 '\0' 结尾，占 n + 1 字节
+} ColumnType;
 
-// 行属性
 typedef struct {
-    uint32_t id;
-    char username[COLUMN_USERNAME_SIZE + 1];
-    char email[COLUMN_EMAIL_SIZE + 1];
-} Row;
+    char name[SCHEMA_NAME_SIZE];
+    uint32_t type;
+    uint32_t length; // char(n)、varchar(n) 中的 n
+    uint32_t offset; // 在行中的字节偏移
+    uint32_t size;   // 占用的字节数
+} ColumnDef;
+
+// 表结构，由 create table 定义并随元数据页保存；没有定义过时是默认的 users 表。
+// 第一列是 int 整数主键；字符串主键模式下第二列是主键，必须是 varchar
+typedef struct {
+    char name[SCHEMA_NAME_SIZE];
+    uint32_t num_columns;
+    ColumnDef columns[SCHEMA_MAX_COLUMNS];
+} Schema;
 
 // 输入信息
 typedef struct {
@@ -62,7 +114,9 @@ void close_input_buffer(InputBuffer* input_buffer) {
 typedef enum {
     EXECUTE_SUCCESS,
     EXECUTE_TABLE_FULL,
-    EXECUTE_DUPLICATE_KEY
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_NOT_PRIMARY_KEY,
+    EXECUTE_TABLE_EXISTS
 } ExecuteResult;
 
 // 元命令，以.开头
@@ -77,66 +131,353 @@ typedef enum {
     PREPARE_SYNTAX_ERROR,
     PREPARE_STRING_TOO_LONG,
     PREPARE_UNRECOGNIZED_STATEMENT,
-    PREPARE_NEGATIVE_ID
+    PREPARE_NEGATIVE_ID,
+    PREPARE_INVALID_SCHEMA
 } PrepareResult;
 
+// 压缩模式下页号到磁盘区段的映射
+typedef struct {
+    uint32_t offset; // 区段在文件中的字节偏移
+    uint32_t length; // 存储的字节数：0 表示从未写过，PAGE_SIZE 表示未压缩
+} PageMapEntry;
+
+// 进行中的在线备份
 typedef struct {
+    char* dest;
+    char* temp_path;
+    int file_descriptor;
+    uint32_t next_page;              // 小于它的页都已复制过
+    bool recopy[TABLE_MAX_PAGES];    // 复制之后又被改写、需要重新复制的页
+    uint8_t* chunk;                  // 一次顺序写出的连续页
+} Backup;
+
+typedef struct {
+    char* filename;
     int file_descriptor;
     uint32_t file_length;
     uint32_t num_pages;
     void* pages[TABLE_MAX_PAGES];
+    // 页框区：打开时一次性分配的按页对齐的连续内存，第 i 页固定使用第 i 个页框
+    void* frames;
+    bool direct; // 以 O_DIRECT 打开，读写绕过内核页缓存直达页框
+    // 压缩模式：叶节点压缩后写入变长区段，页映射记录每页所在的区段
+    bool compressed;
+    PageMapEntry page_map[TABLE_MAX_PAGES];
+    uint32_t extent_end; // 已用区段的末尾，新区段追加在这里
+    uint32_t num_free_extents;
+    PageMapEntry free_extents[TABLE_MAX_PAGES + 1]; // 按偏移排序的空闲区段，相邻的会合并
+    // 本次写出页映射之前释放的区段：落盘的页映射可能还指向它们，页映射落盘后才并入空闲列表
+    uint32_t num_released_extents;
+    PageMapEntry released_extents[TABLE_MAX_PAGES];
+    // 本事务内写过的页，提交时刷盘
+    bool dirty[TABLE_MAX_PAGES];
+    uint32_t num_dirty_pages;
+    uint32_t dirty_pages[TABLE_MAX_PAGES];
+    // 可直接复用的空闲页
+    uint32_t num_free_pages;
+    uint32_t free_pages[TABLE_MAX_PAGES];
+    // 已被新版本替换、但可能仍被旧快照引用的页，记录释放它的事务号
+    uint32_t num_pending_pages;
+    uint32_t pending_pages[TABLE_MAX_PAGES];
+    uint64_t pending_txn_ids[TABLE_MAX_PAGES];
+    // 只读共享映射，快照读者直接从这里读已提交的页，不经过页缓存
+    void* map;
+    Backup* backup;
+    // 引用位：本次会话访问过的页，关闭时记入热页文件。快照读者也会置位，所以是原子的
+    _Atomic bool referenced[TABLE_MAX_PAGES];
+    // 打开时从热页文件读出、尚待预热的页，按页号排序
+    uint32_t* warm_pages;
+    uint32_t num_warm_pages;
+    uint32_t next_warm_page;
 } Pager;
 
 typedef struct {
     uint32_t root_page_num;
     Pager* pager;
+    uint32_t flags;
+    // 最近一次提交的根页和事务号，供快照读者无锁读取
+    _Atomic uint32_t committed_root_page_num;
+    _Atomic uint64_t committed_txn_id;
+    // 读者表：每个槽记录一个活跃快照的事务号，0 表示空闲
+    _Atomic uint64_t readers[MAX_SNAPSHOT_READERS];
+    struct Scan* scan; // 进行中的后台扫描（.scan），没有时为 NULL
+    // 写入模式的内存表，NULL 表示插入直接写树
+    struct Memtable* memtable;
+    // 分区表的各分区。分区表本身不对应文件，pager 为 NULL
+    struct Partitions* partitions;
+    Schema schema;
+    // 关闭时是否记录热页文件（--warm），跨越整理时的重新打开保持不变
+    bool warm;
 } Table;
 
+// 快照：固定某次提交的根页，之后的写入对其不可见
+typedef struct {
+    Table* table;
+    uint32_t root_page_num;
+    uint64_t txn_id;
+    uint32_t slot;
+} Snapshot;
+
+// 字符串主键：按字节比较，较短的前缀排在前面
+typedef struct {
+    uint32_t length;
+    uint8_t data[COLUMN_USERNAME_SIZE];
+} Key;
+
 // 游标抽象
 typedef struct {
     Table* table;
+    Snapshot* snapshot; // 非空时从快照读取
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table; // 标识表末尾
+    // 从根到叶的下降路径：path[i] 为第 i 层内部节点，child_index[i] 为走向的子节点下标
+    uint32_t depth;
+    uint32_t path[TREE_MAX_HEIGHT];
+    uint32_t child_index[TREE_MAX_HEIGHT];
 } Cursor;
 
 
 // SQL语句类型
 typedef enum {
     STATEMENT_INSERT,
-    STATEMENT_SELECT
+    STATEMENT_SELECT,
+    STATEMENT_CREATE
 } StatementType;
 
+// 行中的列：在表结构中的序号加一，0 表示没有
+typedef uint32_t Column;
+#define COLUMN_NONE 0
+#define COLUMN_ID 1         // 第一列，整数主键
+#define COLUMN_STRING_KEY 2 // 第二列，字符串主键模式下的主键
+
+typedef enum {
+    FILTER_EQUAL,   // <列> = <值>
+    FILTER_PREFIX,  // <列> like '<前缀>%'
+    FILTER_BETWEEN, // <列> between <下界> and <上界>，两端都包含
+    FILTER_IN       // <列> in (<值>, ...)，只支持 int 和能放进键的字符串列
+} FilterType;
+
+// where 条件：值按列的类型编码，between 时 value 是下界，high_value 是上界
+typedef struct {
+    Column column;      // COLUMN_NONE 表示没有条件
+    ColumnDef def;
+    FilterType type;
+    uint32_t length;    // like 的前缀长度
+    uint8_t value[MAX_ROW_SIZE];
+    uint8_t high_value[MAX_ROW_SIZE];
+    uint32_t num_keys;  // in 的值列表，按主键的编码存放；只在解析 in 时分配，见 statement_free
+    Key* keys;
+} Filter;
+
 // SQL语句
 typedef struct {
     StatementType type;
     Row row_to_insert;  // only used by insert statement
+    Schema schema;      // create table 定义的表结构
+    // select 的选项
+    uint32_t num_columns; // 要输出的列，0 表示全部
+    Column columns[SCHEMA_MAX_COLUMNS];
+    bool count;         // select count(*)
+    Filter filter;
+    Column order_by;    // 只能按主键排序，COLUMN_NONE 表示默认的主键升序
+    bool descending;
+    uint32_t limit;     // UINT32_MAX 表示不限
+    uint32_t offset;
 } Statement;
 
-// 打印行
-void print_row(Row* row) {
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
-}
+// 语句的输出都写到这里：交互模式下是 stdout，服务模式下是当前请求的输出缓冲
+FILE* output_stream;
+
+// 服务模式下 .backup 只启动备份，由事件循环在请求之间分步复制
+bool backup_in_background = false;
 
 // 打印提示符
 void print_prompt() {
     printf("db > ");
 }
 
-// 各字段size和offset
-#define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
-
-const uint32_t ID_SIZE = size_of_attribute(Row, id);
-const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
+// 主键在行中的位置：整数主键是第一列，字符串主键是紧随其后的第二列
+const uint32_t ID_SIZE = sizeof(uint32_t);
 const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+const uint32_t STRING_KEY_OFFSET = ID_OFFSET + ID_SIZE;
+
+// 字符串列与条件值比较，列以 '\0' 填充
+int compare_field(const char* field, uint32_t field_size, const char* value, uint32_t length) {
+    uint32_t field_length = strnlen(field, field_size);
+    int result = memcmp(field, value, field_length < length ? field_length : length);
+    if (result != 0) {
+        return result;
+    }
+    return (field_length > length) - (field_length < length);
+}
+
+// 各类型的编解码函数：文本值编码进字段、输出字段、比较两个字段。
+// 字段都在行内的固定偏移上，直接读写页内数据，不经过中间的行结构
+PrepareResult int_parse(ColumnDef* column, const char* text, uint32_t length, void* field) {
+    (void)column;
+    char* end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (length == 0 || end != text + length || errno != 0 || value < INT32_MIN || value > INT32_MAX) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    int32_t number = value;
+    memcpy(field, &number, sizeof(number));
+    return PREPARE_SUCCESS;
+}
+
+void int_print(ColumnDef* column, const void* field) {
+    (void)column;
+    int32_t value;
+    memcpy(&value, field, sizeof(value));
+    fprintf(output_stream, "%d", value);
+}
+
+int int_compare(ColumnDef* column, const void* a, const void* b) {
+    (void)column;
+    int32_t x;
+    int32_t y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+}
+
+PrepareResult float_parse(ColumnDef* column, const char* text, uint32_t length, void* field) {
+    (void)column;
+    char* end;
+    double value = strtod(text, &end);
+    if (length == 0 || end != text + length) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    memcpy(field, &value, sizeof(value));
+    return PREPARE_SUCCESS;
+}
+
+void float_print(ColumnDef* column, const void* field) {
+    (void)column;
+    double value;
+    memcpy(&value, field, sizeof(value));
+    fprintf(output_stream, "%.15g", value);
+}
+
+int float_compare(ColumnDef* column, const void* a, const void* b) {
+    (void)column;
+    double x;
+    double y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+}
+
+// char 和 varchar 共用：都以 '\0' 填充到列宽，只是 varchar 多留一个结尾字节
+PrepareResult string_parse(ColumnDef* column, const char* text, uint32_t length, void* field) {
+    if (length > column->length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    memset(field, 0, column->size);
+    memcpy(field, text, length);
+    return PREPARE_SUCCESS;
+}
+
+void string_print(ColumnDef* column, const void* field) {
+    fprintf(output_stream, "%.*s", (int)strnlen(field, column->size), (const char*)field);
+}
+
+int string_compare(ColumnDef* column, const void* a, const void* b) {
+    return compare_field(a, column->size, b, strnlen(b, column->size));
+}
+
+typedef struct {
+    const char* name;
+    bool sized; // 类型名后带 (n)
+    PrepareResult (*parse)(ColumnDef* column, const char* text, uint32_t length, void* field);
+    void (*print)(ColumnDef* column, const void* field);
+    int (*compare)(ColumnDef* column, const void* a, const void* b);
+} TypeCodec;
+
+const TypeCodec TYPE_CODECS[] = {
+    [TYPE_INT] = {"int", false, int_parse, int_print, int_compare},
+    [TYPE_FLOAT] = {"float", false, float_parse, float_print, float_compare},
+    [TYPE_CHAR] = {"char", true, string_parse, string_print, string_compare},
+    [TYPE_VARCHAR] = {"varchar", true, string_parse, string_print, string_compare},
+};
+
+uint32_t column_size(ColumnType type, uint32_t length) {
+    switch (type) {
+        case (TYPE_INT):
+            return sizeof(int32_t);
+        case (TYPE_FLOAT):
+            return sizeof(double);
+        case (TYPE_CHAR):
+            return length;
+        default:
+            return length + 1;
+    }
+}
+
+// 在表结构末尾追加一列，紧接上一列存放。列数或总宽超出时返回 false
+bool schema_add_column(Schema* schema, const char* name, ColumnType type, uint32_t length) {
+    uint32_t offset = 0;
+    if (schema->num_columns > 0) {
+        ColumnDef* last = &schema->columns[schema->num_columns - 1];
+        offset = last->offset + last->size;
+    }
+    uint32_t size = column_size(type, length);
+    if (schema->num_columns >= SCHEMA_MAX_COLUMNS || strlen(name) >= SCHEMA_NAME_SIZE || offset + size > MAX_ROW_SIZE) {
+        return false;
+    }
+    ColumnDef* column = &schema->columns[schema->num_columns++];
+    memset(column, 0, sizeof(ColumnDef));
+    strcpy(column->name, name);
+    column->type = type;
+    column->length = length;
+    column->offset = offset;
+    column->size = size;
+    return true;
+}
+
+// 一行的字节数：最后一列的结束位置
+uint32_t schema_row_size(Schema* schema) {
+    ColumnDef* last = &schema->columns[schema->num_columns - 1];
+    return last->offset + last->size;
+}
+
+uint32_t table_row_size(Table* table) {
+    return schema_row_size(&table->schema);
+}
+
+// 没有 create table 过的数据库沿用最初的表结构
+void default_schema(Schema* schema) {
+    memset(schema, 0, sizeof(Schema));
+    strcpy(schema->name, "users");
+    schema_add_column(schema, "id", TYPE_INT, 0);
+    schema_add_column(schema, "username", TYPE_VARCHAR, COLUMN_USERNAME_SIZE);
+    schema_add_column(schema, "email", TYPE_VARCHAR, COLUMN_EMAIL_SIZE);
+}
+
+Column parse_column(Schema* schema, const char* name) {
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        if (strcmp(schema->columns[i].name, name) == 0) {
+            return i + 1;
+        }
+    }
+    return COLUMN_NONE;
+}
+
+void print_schema(Schema* schema) {
+    fprintf(output_stream, "create table %s (", schema->name);
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        ColumnDef* column = &schema->columns[i];
+        fprintf(output_stream, "%s%s %s", i > 0 ? ", " : "", column->name, TYPE_CODECS[column->type].name);
+        if (TYPE_CODECS[column->type].sized) {
+            fprintf(output_stream, "(%d)", column->length);
+        }
+    }
+    fprintf(output_stream, ")\n");
+}
 
 const uint32_t PAGE_SIZE = 4096;
-const uint32_t ROWS_PER_PAGE = PAGE_SIZE / ROW_SIZE;
-const uint32_t TABLE_MAX_ROWS = ROWS_PER_PAGE * TABLE_MAX_PAGES;
 
 // B+树节点类型
 typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
@@ -146,6 +487,7 @@ const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
 const uint32_t NODE_TYPE_OFFSET = 0;
 const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
 const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+// 父指针字段已不再使用（分裂靠下降路径找父节点）；内部节点用它保存最右子树的行数
 const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
 const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
 const uint8_t COMMON_NODE_HEADER_SIZE =
@@ -161,20 +503,20 @@ const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE
                                        + LEAF_NODE_NUM_CELLS_SIZE
                                        + LEAF_NODE_NEXT_LEAF_SIZE;
 
-// 叶节点内部布局
+// 叶节点内部布局。值的宽度是表结构的行宽，单元格大小和每页的单元格数随之而定
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
 const uint32_t LEAF_NODE_VALUE_OFFSET =
         LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS =
-        LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
 
-// 分裂时，右边比左边相等或者少一个
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+uint32_t leaf_node_cell_size(uint32_t row_size) {
+    return LEAF_NODE_KEY_SIZE + row_size;
+}
+
+uint32_t leaf_node_max_cells(uint32_t row_size) {
+    return LEAF_NODE_SPACE_FOR_CELLS / leaf_node_cell_size(row_size);
+}
 
 // 内部节点头部布局
 const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
@@ -185,15 +527,83 @@ INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
 const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
 INTERNAL_NODE_NUM_KEYS_SIZE +
 INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_ROWS_OFFSET = PARENT_POINTER_OFFSET;
 
 // 内部节点体布局
-// 内部是一个单元格数组，其中每个单元格都包含一个子指针和一个键。每个键都应该是其左侧子项中包含的最大键。
+// 内部是一个单元格数组，其中每个单元格都包含一个子指针、一个键和子树中的行数。每个键都应该是其左侧子项中包含的最大键。
+// 有了子树行数，按位置定位和统计键区间内的行数都只需一次下降。
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_ROWS_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CELL_SIZE =
-        INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+        INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_ROWS_SIZE;
 const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
 
+// 字符串主键的节点布局（META_FLAG_STRING_KEY，以 username 为主键）。
+// 叶节点：节点头之后是本页所有键的公共前缀，再之后是槽数组，每个槽是 2 字节偏移，
+// 指向从页尾向前排布的记录：1 字节后缀长度、键后缀、行数据。
+// 内部节点：单元格布局不变，原来放键的 4 字节改为分隔键在页尾区域中的偏移和长度。
+// 分隔键取右侧子树最小键的最短区分前缀，小于分隔键的键走左边；按字节数而不是单元格数判断是否已满。
+const uint32_t STRING_LEAF_PREFIX_LENGTH_OFFSET = LEAF_NODE_HEADER_SIZE;
+const uint32_t STRING_LEAF_PREFIX_OFFSET = STRING_LEAF_PREFIX_LENGTH_OFFSET + sizeof(uint8_t);
+const uint32_t STRING_LEAF_SLOTS_OFFSET = STRING_LEAF_PREFIX_OFFSET + COLUMN_USERNAME_SIZE;
+const uint32_t STRING_LEAF_SLOT_SIZE = sizeof(uint16_t);
+const uint32_t STRING_INTERNAL_MAX_KEYS =
+        (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / (INTERNAL_NODE_CELL_SIZE + 1);
+
+// 元数据页布局
+// 第 0、1 页轮流写入，打开时取校验通过且事务号较大的一页。
+// 提交时先刷数据页再写元数据页，根页号的切换因此是原子的。
+// 结构体之后是空闲页表，和根页号、页数一起随元数据页原子切换；版本 1 的文件没有空闲页表。
+// 版本 3 起内部节点单元格带子树行数，更早的文件打开时迁移到当前版本。
+#define META_MAGIC 0x4D424458
+#define META_VERSION 3
+#define META_FLAG_COW 0x1 // 影子分页（写时复制）模式
+#define META_FLAG_COMPRESSED 0x2 // 叶节点压缩存储
+#define META_FLAG_STRING_KEY 0x4 // 以变长字符串（第二列）为主键
+#define META_FLAG_SCHEMA 0x8 // 表结构由 create table 定义，保存在元数据页末尾
+#define OPEN_FLAG_DIRECT 0x10000 // 只影响本次打开的 I/O 方式，不写入元数据页
+#define OPEN_FLAG_INGEST 0x20000 // 本次打开启用内存表写入模式，不写入元数据页
+#define OPEN_FLAG_WARM 0x40000 // 本次打开按热页文件预热，关闭时记录热页，不写入元数据页
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t root_page_num;
+    uint32_t num_pages;
+    uint32_t num_free_pages; // 紧跟在结构体之后的空闲页数
+    uint64_t txn_id;
+    uint32_t checksum;
+} MetaPage;
+
+// 分区表的数据库文件只存这份清单，各分区是独立的数据库文件 <数据库文件>.<编号>。
+// 第 i 个分区包含 [lows[i], lows[i + 1]) 的 id，lows[0] 为 0
+typedef struct {
+    uint32_t magic;
+    uint32_t num_partitions;
+    uint32_t next_file_id; // 下一个新分区文件的编号
+    uint32_t lows[MAX_PARTITIONS];
+    uint32_t file_ids[MAX_PARTITIONS];
+    uint32_t checksum;     // 之前各字段的 FNV 哈希
+} PartitionManifest;
+
+uint32_t* meta_free_pages(void* page) {
+    return page + sizeof(MetaPage);
+}
+
+// create table 定义的表结构放在元数据页末尾
+Schema* meta_schema(void* page) {
+    return page + PAGE_SIZE - sizeof(Schema);
+}
+
+const uint32_t META_PAGE_COUNT = 2;
+
+// 压缩模式的文件布局：元数据页之后是定长的页映射区，再之后是变长区段。
+// 区段按 EXTENT_ALIGN 对齐分配，页面变小时原地覆盖，变大时搬到新区段。
+const uint32_t PAGE_MAP_PAGES =
+        (TABLE_MAX_PAGES * sizeof(PageMapEntry) + PAGE_SIZE - 1) / PAGE_SIZE;
+const uint32_t EXTENT_ALIGN = 256;
 
 
 NodeType get_node_type(void* node) {
@@ -210,28 +620,28 @@ uint32_t* leaf_node_num_cells(void* node) {
     return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
 
-void* leaf_node_cell(void* node, uint32_t cell_num) {
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+void* leaf_node_cell(void* node, uint32_t cell_num, uint32_t row_size) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * leaf_node_cell_size(row_size);
 }
 
-uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
-    return leaf_node_cell(node, cell_num);
+uint32_t* leaf_node_key(void* node, uint32_t cell_num, uint32_t row_size) {
+    return leaf_node_cell(node, cell_num, row_size);
 }
 
-void* leaf_node_value(void* node, uint32_t cell_num) {
-    return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+void* leaf_node_value(void* node, uint32_t cell_num, uint32_t row_size) {
+    return leaf_node_cell(node, cell_num, row_size) + LEAF_NODE_KEY_SIZE;
 }
 
 uint32_t* leaf_node_next_leaf(void* node) {
     return node + LEAF_NODE_NEXT_LEAF_OFFSET;
 }
 
-uint32_t* node_parent(void* node) {
-    return node + PARENT_POINTER_OFFSET;
-}
 
-// 假设在具有 N 页的数据库中，分配了页码 0 到 N-1。因此，我们始终可以为新页面分配页码 N
+// 优先复用空闲页。否则假设在具有 N 页的数据库中，分配了页码 0 到 N-1。因此，我们始终可以为新页面分配页码 N
 uint32_t get_unused_page_num(Pager* pager) {
+    if (pager->num_free_pages > 0) {
+        return pager->free_pages[--pager->num_free_pages];
+    }
     return pager->num_pages;
 }
 
@@ -273,6 +683,14 @@ uint32_t* internal_node_key(void* node, uint32_t key_num) {
     return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
 }
 
+// 第 child_num 个子树中的行数，最右子树的行数在节点头中
+uint32_t* internal_node_child_rows(void* node, uint32_t child_num) {
+    if (child_num == *internal_node_num_keys(node)) {
+        return node + INTERNAL_NODE_RIGHT_CHILD_ROWS_OFFSET;
+    }
+    return (void*)internal_node_cell(node, child_num) + INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+}
+
 // 对于内部节点，最大键始终是其右键。对于叶节点，它是最大索引处的键
 //uint32_t get_node_max_key(void* node) {
 //    switch (get_node_type(node)) {
@@ -305,743 +723,5118 @@ void initialize_internal_node(void* node) {
     set_node_root(node, false);
     *internal_node_num_keys(node) = 0;
     *internal_node_right_child(node) = INVALID_PAGE_NUM;
+    *internal_node_child_rows(node, 0) = 0;
+}
+
+// 节点下的总行数：叶节点是单元格数，内部节点是各子树行数之和
+uint32_t node_num_rows(void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_num_cells(node);
+    }
+    uint32_t num_rows = 0;
+    for (uint32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+        num_rows += *internal_node_child_rows(node, i);
+    }
+    return num_rows;
 }
 
-// 序列化
-void serialize_row(Row* source, void* destination) {
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    strncpy(destination + USERNAME_OFFSET, source->username, USERNAME_SIZE);
-    strncpy(destination + EMAIL_OFFSET, source->email, EMAIL_SIZE);
+void key_from_value(bool string_key, void* value, Key* key);
+
+// 字符串主键从行中取出
+void key_from_row(Row* row, Key* key) {
+    key_from_value(true, row->data, key);
+}
+
+// 序列化：行在解析时已按表结构编码，整行复制即可
+void serialize_row(Row* source, void* destination, uint32_t row_size) {
+    memcpy(destination, source->data, row_size);
 }
 
 // 反序列化
-void deserialize_row(void* source, Row* destination) {
-    memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+void deserialize_row(void* source, Row* destination, uint32_t row_size) {
+    memcpy(destination->data, source, row_size);
 }
 
+// 整数主键按 int 解析并拒绝负数，按 uint32 读出的值与之相同
+uint32_t row_id(Row* row) {
+    uint32_t id;
+    memcpy(&id, row->data + ID_OFFSET, ID_SIZE);
+    return id;
+}
 
-// 获取页面
-void* get_page(Pager* pager, uint32_t page_num) {
-    if (page_num > TABLE_MAX_PAGES) {
-        printf("Tried to fetch page number out of bounds. %d > %d\n",
-               page_num, TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
+int compare_keys(const Key* a, const Key* b) {
+    uint32_t length = a->length < b->length ? a->length : b->length;
+    int result = memcmp(a->data, b->data, length);
+    if (result != 0) {
+        return result;
     }
+    return (a->length > b->length) - (a->length < b->length);
+}
 
-    if (pager->pages[page_num] == NULL) {
-        // 缓存未命中，分配内存
-        void* page = malloc(PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
-
-        // 未满页
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
-        }
+int compare_key_entries(const void* a, const void* b) {
+    return compare_keys(a, b);
+}
 
-        // 如果请求的页面位于文件的范围之外，我们知道它应该是空白的，所以我们只需分配一些内存并返回它。稍后将缓存刷新到磁盘时，该页面将被添加到文件中。
-        if (page_num <= num_pages) {
-             lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
 
-            if (bytes_read == -1) {
-                printf("Error reading file: %d\n", errno);
-                exit(EXIT_FAILURE);
-            }
-        }
-        pager->pages[page_num] = page;
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
-        }
+// 整数主键按大端序放进 Key，按字节比较的结果与按数值比较一致
+void key_from_id(uint32_t id, Key* key) {
+    key->length = sizeof(uint32_t);
+    for (uint32_t i = 0; i < sizeof(uint32_t); i++) {
+        key->data[i] = id >> (8 * (sizeof(uint32_t) - 1 - i));
     }
+}
 
-    return pager->pages[page_num];
+uint32_t key_as_id(Key* key) {
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < sizeof(uint32_t); i++) {
+        id = (id << 8) | key->data[i];
+    }
+    return id;
 }
 
-uint32_t get_node_max_key(Pager* pager, void* node) {
-    if (get_node_type(node) == NODE_LEAF) {
-        return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+// 从序列化的行中取出主键
+void key_from_value(bool string_key, void* value, Key* key) {
+    if (string_key) {
+        key->length = strnlen(value + STRING_KEY_OFFSET, COLUMN_USERNAME_SIZE);
+        memcpy(key->data, value + STRING_KEY_OFFSET, key->length);
+    } else {
+        uint32_t id;
+        memcpy(&id, value + ID_OFFSET, ID_SIZE);
+        key_from_id(id, key);
     }
-    void* right_child = get_page(pager,*internal_node_right_child(node));
-    return get_node_max_key(pager, right_child);
 }
 
-void pager_flush(Pager* pager, uint32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
-        printf("Tried to flush null page\n");
-        exit(EXIT_FAILURE);
+uint32_t common_prefix_length(const Key* a, const Key* b) {
+    uint32_t length = 0;
+    while (length < a->length && length < b->length && a->data[length] == b->data[length]) {
+        length++;
     }
+    return length;
+}
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        printf("Error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
+// 内存表：按主键排序的跳表，节点保存序列化后的整行。
+// 第 0 层另有前驱指针，降序扫描时向左走。
+typedef struct MemtableNode {
+    Key key;
+    uint8_t* value;               // 行数据紧跟在 next 数组之后，与节点一起分配
+    struct MemtableNode* prev;    // 第一个节点的前驱为 NULL
+    struct MemtableNode* next[];  // 节点的高度由分配时决定
+} MemtableNode;
+
+typedef struct Memtable {
+    MemtableNode* head; // 哨兵节点，高度为 MEMTABLE_MAX_HEIGHT
+    uint32_t height;
+    uint32_t num_rows;
+    uint32_t random_state;
+} Memtable;
+
+MemtableNode* new_memtable_node(uint32_t height, uint32_t row_size) {
+    MemtableNode* node = malloc(sizeof(MemtableNode) + height * sizeof(MemtableNode*) + row_size);
+    node->value = (uint8_t*)&node->next[height];
+    node->prev = NULL;
+    for (uint32_t i = 0; i < height; i++) {
+        node->next[i] = NULL;
     }
+    return node;
+}
 
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1) {
-        printf("Error writing: %d\n", errno);
-        exit(EXIT_FAILURE);
+Memtable* new_memtable() {
+    Memtable* memtable = malloc(sizeof(Memtable));
+    memtable->head = new_memtable_node(MEMTABLE_MAX_HEIGHT, 0);
+    memtable->height = 1;
+    memtable->num_rows = 0;
+    memtable->random_state = 2463534242u;
+    return memtable;
+}
+
+void free_memtable(Memtable* memtable) {
+    MemtableNode* node = memtable->head;
+    while (node != NULL) {
+        MemtableNode* next = node->next[0];
+        free(node);
+        node = next;
     }
+    free(memtable);
 }
 
-void db_close(Table* table) {
-    Pager* pager = table->pager;
-    // 释放缓存
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
+// 每升高一层的概率为 1/4
+uint32_t memtable_random_height(Memtable* memtable) {
+    uint32_t height = 1;
+    while (height < MEMTABLE_MAX_HEIGHT) {
+        memtable->random_state ^= memtable->random_state << 13;
+        memtable->random_state ^= memtable->random_state >> 17;
+        memtable->random_state ^= memtable->random_state << 5;
+        if ((memtable->random_state & 3) != 0) {
+            break;
         }
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
-    }
-    // 关闭文件
-    int result = close(pager->file_descriptor);
-    if (result == -1) {
-        printf("Error closing db file.\n");
-        exit(EXIT_FAILURE);
+        height++;
     }
+    return height;
+}
 
-    // 释放pager
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        void* page = pager->pages[i];
-        if (page) {
-            free(page);
-            pager->pages[i] = NULL;
+// 第一个不小于 key 的节点，没有时返回 NULL；update 非空时记录每层的前驱
+MemtableNode* memtable_seek(Memtable* memtable, Key* key, MemtableNode** update) {
+    MemtableNode* node = memtable->head;
+    for (int32_t level = memtable->height - 1; level >= 0; level--) {
+        while (node->next[level] != NULL && compare_keys(&node->next[level]->key, key) < 0) {
+            node = node->next[level];
+        }
+        if (update != NULL) {
+            update[level] = node;
         }
     }
-
-    // 释放table
-    free(pager);
-    free(table);
+    return node->next[0];
 }
 
-void print_constants() {
-    printf("ROW_SIZE: %d\n", ROW_SIZE);
-    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+MemtableNode* memtable_first(Memtable* memtable) {
+    return memtable->head->next[0];
 }
 
-// B+树可视化
-void indent(uint32_t level) {
-    for (uint32_t i = 0; i < level; i++) {
-        printf("  ");
+MemtableNode* memtable_last(Memtable* memtable) {
+    MemtableNode* node = memtable->head;
+    for (int32_t level = memtable->height - 1; level >= 0; level--) {
+        while (node->next[level] != NULL) {
+            node = node->next[level];
+        }
     }
+    return node == memtable->head ? NULL : node;
 }
 
-void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
-    void* node = get_page(pager, page_num);
-    uint32_t num_keys, child;
-
-    switch (get_node_type(node)) {
-        case (NODE_LEAF):
-            num_keys = *leaf_node_num_cells(node);
-            indent(indentation_level);
-            printf("- leaf (size %d)\n", num_keys);
-            for (uint32_t i = 0; i < num_keys; i++) {
-                indent(indentation_level + 1);
-                printf("- %d\n", *leaf_node_key(node, i));
-            }
-            break;
-        case (NODE_INTERNAL):
-            num_keys = *internal_node_num_keys(node);
-            indent(indentation_level);
-            printf("- internal (size %d)\n", num_keys);
-            if (num_keys > 0) {
-                for (uint32_t i = 0; i < num_keys; i++) {
-                    child = *internal_node_child(node, i);
-                    print_tree(pager, child, indentation_level + 1);
-
-                    indent(indentation_level + 1);
-                    printf("- key %d\n", *internal_node_key(node, i));
-                }
-                child = *internal_node_right_child(node);
-                print_tree(pager, child, indentation_level + 1);
-            }
-            break;
+// 最后一个不大于 key 的节点，没有时返回 NULL
+MemtableNode* memtable_seek_last(Memtable* memtable, Key* key) {
+    MemtableNode* node = memtable_seek(memtable, key, NULL);
+    if (node != NULL && compare_keys(&node->key, key) == 0) {
+        return node;
     }
+    return node != NULL ? node->prev : memtable_last(memtable);
 }
 
-
-// 处理元命令
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
-    if (strcmp(input_buffer->buffer, ".exit") == 0) {
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
-        printf("Constants:\n");
-        print_constants();
-        return META_COMMAND_SUCCESS;
-    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-        printf("Tree:\n");
-        print_tree(table->pager, 0, 0);
-        return META_COMMAND_SUCCESS;
-    } else {
-        return META_COMMAND_UNRECOGNIZED_COMMAND;
-    }
+bool memtable_contains(Memtable* memtable, Key* key) {
+    MemtableNode* node = memtable_seek(memtable, key, NULL);
+    return node != NULL && compare_keys(&node->key, key) == 0;
 }
 
+// 调用者保证 key 不在内存表中
+void memtable_insert(Memtable* memtable, Key* key, void* value, uint32_t row_size) {
+    MemtableNode* update[MEMTABLE_MAX_HEIGHT];
+    memtable_seek(memtable, key, update);
+    uint32_t height = memtable_random_height(memtable);
+    for (uint32_t level = memtable->height; level < height; level++) {
+        update[level] = memtable->head;
+    }
+    if (height > memtable->height) {
+        memtable->height = height;
+    }
 
+    MemtableNode* node = new_memtable_node(height, row_size);
+    node->key = *key;
+    memcpy(node->value, value, row_size);
+    for (uint32_t level = 0; level < height; level++) {
+        node->next[level] = update[level]->next[level];
+        update[level]->next[level] = node;
+    }
+    node->prev = update[0] == memtable->head ? NULL : update[0];
+    if (node->next[0] != NULL) {
+        node->next[0]->prev = node;
+    }
+    memtable->num_rows++;
+}
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-
-    Cursor* cursor = malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = page_num;
-
-    // Binary search
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index = num_cells;
-    while (one_past_max_index != min_index) {
-        uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, index);
-        if (key == key_at_index) {
-            cursor->cell_num = index;
-            return cursor;
+// 删除最小的 count 个节点
+void memtable_remove_first(Memtable* memtable, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        MemtableNode* node = memtable->head->next[0];
+        for (uint32_t level = 0; level < memtable->height && memtable->head->next[level] == node; level++) {
+            memtable->head->next[level] = node->next[level];
         }
-        if (key < key_at_index) {
-            one_past_max_index = index;
-        } else {
-            min_index = index + 1;
+        if (node->next[0] != NULL) {
+            node->next[0]->prev = NULL;
         }
+        free(node);
+        memtable->num_rows--;
+    }
+    while (memtable->height > 1 && memtable->head->next[memtable->height - 1] == NULL) {
+        memtable->height--;
     }
-
-    cursor->cell_num = min_index;
-    return cursor;
 }
 
+uint8_t* string_leaf_prefix_length(void* node) {
+    return node + STRING_LEAF_PREFIX_LENGTH_OFFSET;
+}
 
+uint16_t* string_leaf_slot(void* node, uint32_t cell_num) {
+    return node + STRING_LEAF_SLOTS_OFFSET + cell_num * STRING_LEAF_SLOT_SIZE;
+}
 
+uint8_t* string_leaf_record(void* node, uint32_t cell_num) {
+    return node + *string_leaf_slot(node, cell_num);
+}
 
+// 还原完整的键：公共前缀加上记录中的后缀
+void string_leaf_key(void* node, uint32_t cell_num, Key* key) {
+    uint8_t prefix_length = *string_leaf_prefix_length(node);
+    uint8_t* record = string_leaf_record(node, cell_num);
+    memcpy(key->data, node + STRING_LEAF_PREFIX_OFFSET, prefix_length);
+    memcpy(key->data + prefix_length, record + 1, record[0]);
+    key->length = prefix_length + record[0];
+}
 
-uint32_t internal_node_find_child(void* node, uint32_t key) {
-    uint32_t num_keys = *internal_node_num_keys(node);
+void* string_leaf_value(void* node, uint32_t cell_num) {
+    uint8_t* record = string_leaf_record(node, cell_num);
+    return record + 1 + record[0];
+}
 
-    /* Binary search to find index of child to search */
-    uint32_t min_index = 0;
-    uint32_t max_index = num_keys; /* there is one more child than key */
+// 键后缀都为空时一页最多的单元格数
+uint32_t string_leaf_max_cells(uint32_t row_size) {
+    return (PAGE_SIZE - STRING_LEAF_SLOTS_OFFSET) / (STRING_LEAF_SLOT_SIZE + sizeof(uint8_t) + row_size);
+}
 
-    while (min_index != max_index) {
-        uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *internal_node_key(node, index);
-        if (key_to_right >= key) {
-            max_index = index;
-        } else {
-            min_index = index + 1;
-        }
+// 解码后的叶节点单元格，value 指向行数据
+typedef struct {
+    Key key;
+    void* value;
+} StringLeafEntry;
+
+// 按 entries 重新编码后所需的字节数（entries 已按键排序）
+uint32_t string_leaf_encoded_size(StringLeafEntry* entries, uint32_t num_cells, uint32_t row_size) {
+    uint32_t prefix_length = 0;
+    if (num_cells > 0) {
+        prefix_length = common_prefix_length(&entries[0].key, &entries[num_cells - 1].key);
     }
-    return min_index;
+    uint32_t size = STRING_LEAF_SLOTS_OFFSET;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        size += STRING_LEAF_SLOT_SIZE + 1 + entries[i].key.length - prefix_length + row_size;
+    }
+    return size;
 }
 
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
-    uint32_t child_index = internal_node_find_child(node, key);
-    uint32_t child_num = *internal_node_child(node, child_index);
-    void* child = get_page(table->pager, child_num);
-    switch (get_node_type(child)) {
-        case NODE_LEAF:
-            return leaf_node_find(table, child_num, key);
-        case NODE_INTERNAL:
-            return internal_node_find(table, child_num, key);
+// 把 entries 写入叶节点，保留节点类型、根标记和 next_leaf。
+// entries 的行数据不能指向 node 本身。
+void string_leaf_encode(void* node, StringLeafEntry* entries, uint32_t num_cells, uint32_t row_size) {
+    uint32_t prefix_length = 0;
+    if (num_cells > 0) {
+        prefix_length = common_prefix_length(&entries[0].key, &entries[num_cells - 1].key);
+        memcpy(node + STRING_LEAF_PREFIX_OFFSET, entries[0].key.data, prefix_length);
+    }
+    *leaf_node_num_cells(node) = num_cells;
+    *string_leaf_prefix_length(node) = prefix_length;
+    uint32_t offset = PAGE_SIZE;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        uint32_t suffix_length = entries[i].key.length - prefix_length;
+        offset -= 1 + suffix_length + row_size;
+        uint8_t* record = node + offset;
+        record[0] = suffix_length;
+        memcpy(record + 1, entries[i].key.data + prefix_length, suffix_length);
+        memcpy(record + 1 + suffix_length, entries[i].value, row_size);
+        *string_leaf_slot(node, i) = offset;
     }
 }
 
-Cursor* table_find(Table* table, uint32_t key) {
-    uint32_t root_page_num = table->root_page_num;
-    void* root_node = get_page(table->pager, root_page_num);
+uint16_t* string_internal_key_offset(void* node, uint32_t key_num) {
+    return (uint16_t*)internal_node_key(node, key_num);
+}
 
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, root_page_num, key);
-    } else {
-        return internal_node_find(table, root_page_num, key);
+uint16_t* string_internal_key_length(void* node, uint32_t key_num) {
+    return string_internal_key_offset(node, key_num) + 1;
+}
+
+void string_internal_key(void* node, uint32_t key_num, Key* key) {
+    key->length = *string_internal_key_length(node, key_num);
+    memcpy(key->data, node + *string_internal_key_offset(node, key_num), key->length);
+}
+
+uint32_t string_internal_encoded_size(Key* keys, uint32_t num_keys) {
+    uint32_t size = INTERNAL_NODE_HEADER_SIZE;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        size += INTERNAL_NODE_CELL_SIZE + keys[i].length;
     }
+    return size;
 }
 
-//Cursor* table_start(Table* table) {
-//    Cursor* cursor = malloc(sizeof(Cursor));
-//    cursor->table = table;
-//    cursor->cell_num = 0;
-//    cursor->page_num = table->root_page_num;
-//    void* root_node = get_page(table->pager, table->root_page_num);
-//    uint32_t num_cells = *leaf_node_num_cells(root_node);
-//    cursor->end_of_table = (num_cells == 0);
-//
-//    return cursor;
-//}
+// 写入 num_keys 个分隔键和 num_keys + 1 个子节点
+void string_internal_encode(void* node, uint32_t* children, uint32_t* rows, Key* keys, uint32_t num_keys) {
+    *internal_node_num_keys(node) = num_keys;
+    *internal_node_right_child(node) = children[num_keys];
+    *internal_node_child_rows(node, num_keys) = rows[num_keys];
+    uint32_t offset = PAGE_SIZE;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        offset -= keys[i].length;
+        memcpy(node + offset, keys[i].data, keys[i].length);
+        *internal_node_cell(node, i) = children[i];
+        *string_internal_key_offset(node, i) = offset;
+        *string_internal_key_length(node, i) = keys[i].length;
+        *internal_node_child_rows(node, i) = rows[i];
+    }
+}
 
-// 搜索键 0（最小可能键）。即使表中不存在键 0，此方法也会返回最低 id 的位置（最左边叶节点的起点）。
-Cursor* table_start(Table* table) {
-    Cursor* cursor = table_find(table, 0);
 
+// 页压缩编解码器（LZ4 风格的块格式）。
+// 每个序列：标记字节（高 4 位字面量长度，低 4 位匹配长度 - 4，取 15 时后续字节累加），
+// 字面量，2 字节小端回溯距离，匹配长度扩展。最后一个序列只有字面量。
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+uint32_t lz_read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+bool lz_write_length(uint8_t* dst, uint32_t capacity, uint32_t* op, uint32_t length) {
+    while (length >= 255) {
+        if (*op >= capacity) {
+            return false;
+        }
+        dst[(*op)++] = 255;
+        length -= 255;
+    }
+    if (*op >= capacity) {
+        return false;
+    }
+    dst[(*op)++] = length;
+    return true;
+}
+
+// 写出一个序列；match_length 为 0 表示最后一个只含字面量的序列
+bool lz_write_sequence(uint8_t* dst, uint32_t capacity, uint32_t* op, const uint8_t* literals,
+                       uint32_t literal_length, uint32_t offset, uint32_t match_length) {
+    uint32_t literal_token = literal_length < 15 ? literal_length : 15;
+    uint32_t match_token = 0;
+    if (match_length > 0) {
+        match_token = match_length - LZ_MIN_MATCH < 15 ? match_length - LZ_MIN_MATCH : 15;
+    }
+    if (*op >= capacity) {
+        return false;
+    }
+    dst[(*op)++] = (literal_token << 4) | match_token;
+    if (literal_token == 15 && !lz_write_length(dst, capacity, op, literal_length - 15)) {
+        return false;
+    }
+    if (*op + literal_length > capacity) {
+        return false;
+    }
+    memcpy(dst + *op, literals, literal_length);
+    *op += literal_length;
+    if (match_length == 0) {
+        return true;
+    }
+    if (*op + 2 > capacity) {
+        return false;
+    }
+    dst[(*op)++] = offset & 0xFF;
+    dst[(*op)++] = offset >> 8;
+    if (match_token == 15 && !lz_write_length(dst, capacity, op, match_length - LZ_MIN_MATCH - 15)) {
+        return false;
+    }
+    return true;
+}
+
+// 压缩 src；结果放不进 capacity 字节时返回 0
+uint32_t lz_compress(const uint8_t* src, uint32_t length, uint8_t* dst, uint32_t capacity) {
+    int32_t table[1 << LZ_HASH_BITS];
+    for (uint32_t i = 0; i < (1 << LZ_HASH_BITS); i++) {
+        table[i] = -1;
+    }
+
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint32_t op = 0;
+    while (ip + LZ_MIN_MATCH <= length) {
+        uint32_t sequence = lz_read32(src + ip);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int32_t reference = table[hash];
+        table[hash] = ip;
+        if (reference < 0 || ip - reference > LZ_MAX_OFFSET || lz_read32(src + reference) != sequence) {
+            ip++;
+            continue;
+        }
+        uint32_t match_length = LZ_MIN_MATCH;
+        while (ip + match_length < length && src[reference + match_length] == src[ip + match_length]) {
+            match_length++;
+        }
+        if (!lz_write_sequence(dst, capacity, &op, src + anchor, ip - anchor, ip - reference, match_length)) {
+            return 0;
+        }
+        ip += match_length;
+        anchor = ip;
+    }
+    if (!lz_write_sequence(dst, capacity, &op, src + anchor, length - anchor, 0, 0)) {
+        return 0;
+    }
+    return op;
+}
+
+bool lz_read_length(const uint8_t* src, uint32_t length, uint32_t* ip, uint32_t* value) {
+    uint8_t byte;
+    do {
+        if (*ip >= length) {
+            return false;
+        }
+        byte = src[(*ip)++];
+        *value += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// 解压 src，返回解出的字节数；数据损坏时返回 UINT32_MAX
+uint32_t lz_decompress(const uint8_t* src, uint32_t length, uint8_t* dst, uint32_t capacity) {
+    uint32_t ip = 0;
+    uint32_t op = 0;
+    while (ip < length) {
+        uint8_t token = src[ip++];
+        uint32_t literal_length = token >> 4;
+        if (literal_length == 15 && !lz_read_length(src, length, &ip, &literal_length)) {
+            return UINT32_MAX;
+        }
+        if (ip + literal_length > length || op + literal_length > capacity) {
+            return UINT32_MAX;
+        }
+        memcpy(dst + op, src + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == length) {
+            break;
+        }
+
+        if (ip + 2 > length) {
+            return UINT32_MAX;
+        }
+        uint32_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        uint32_t match_length = token & 0xF;
+        if (match_length == 15 && !lz_read_length(src, length, &ip, &match_length)) {
+            return UINT32_MAX;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || op + match_length > capacity) {
+            return UINT32_MAX;
+        }
+        // 匹配可能与输出重叠（如连续的零），逐字节复制
+        for (uint32_t i = 0; i < match_length; i++) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += match_length;
+    }
+    return op;
+}
+
+uint32_t extent_capacity(uint32_t length) {
+    return (length + EXTENT_ALIGN - 1) / EXTENT_ALIGN * EXTENT_ALIGN;
+}
+
+// 归还区段：插入按偏移排序的空闲列表并与相邻区段合并，紧挨文件末尾的直接收缩 extent_end
+void pager_free_extent(Pager* pager, uint32_t offset, uint32_t capacity) {
+    uint32_t index = 0;
+    while (index < pager->num_free_extents && pager->free_extents[index].offset < offset) {
+        index++;
+    }
+    memmove(&pager->free_extents[index + 1], &pager->free_extents[index],
+            (pager->num_free_extents - index) * sizeof(PageMapEntry));
+    pager->free_extents[index].offset = offset;
+    pager->free_extents[index].length = capacity;
+    pager->num_free_extents++;
+
+    if (index + 1 < pager->num_free_extents &&
+        offset + capacity == pager->free_extents[index + 1].offset) {
+        pager->free_extents[index].length += pager->free_extents[index + 1].length;
+        memmove(&pager->free_extents[index + 1], &pager->free_extents[index + 2],
+                (pager->num_free_extents - index - 2) * sizeof(PageMapEntry));
+        pager->num_free_extents--;
+    }
+    if (index > 0 &&
+        pager->free_extents[index - 1].offset + pager->free_extents[index - 1].length == offset) {
+        pager->free_extents[index - 1].length += pager->free_extents[index].length;
+        memmove(&pager->free_extents[index], &pager->free_extents[index + 1],
+                (pager->num_free_extents - index - 1) * sizeof(PageMapEntry));
+        pager->num_free_extents--;
+    }
+
+    PageMapEntry* last = &pager->free_extents[pager->num_free_extents - 1];
+    if (last->offset + last->length == pager->extent_end) {
+        pager->extent_end = last->offset;
+        pager->num_free_extents--;
+    }
+}
+
+// 首次适配分配区段，没有合适的空闲区段时追加到末尾
+uint32_t pager_allocate_extent(Pager* pager, uint32_t capacity) {
+    for (uint32_t i = 0; i < pager->num_free_extents; i++) {
+        PageMapEntry* extent = &pager->free_extents[i];
+        if (extent->length < capacity) {
+            continue;
+        }
+        uint32_t offset = extent->offset;
+        extent->offset += capacity;
+        extent->length -= capacity;
+        if (extent->length == 0) {
+            memmove(extent, extent + 1, (pager->num_free_extents - i - 1) * sizeof(PageMapEntry));
+            pager->num_free_extents--;
+        }
+        return offset;
+    }
+    uint32_t offset = pager->extent_end;
+    pager->extent_end += capacity;
+    return offset;
+}
+
+// 从页映射指向的区段读入一页，必要时解压
+void pager_read_extent(Pager* pager, uint32_t page_num, void* page) {
+    PageMapEntry* entry = &pager->page_map[page_num];
+    if (entry->length == 0) {
+        return;
+    }
+    uint8_t buffer[PAGE_SIZE];
+    void* destination = entry->length == PAGE_SIZE ? page : buffer;
+    ssize_t bytes_read = pread(pager->file_descriptor, destination, entry->length, entry->offset);
+    if (bytes_read != entry->length) {
+        printf("Error reading page %d: %d\n", page_num, errno);
+        exit(EXIT_FAILURE);
+    }
+    if (entry->length != PAGE_SIZE &&
+        lz_decompress(buffer, entry->length, page, PAGE_SIZE) != PAGE_SIZE) {
+        printf("Page %d is not a valid compressed page. Corrupt file.\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void pager_write_page_map(Pager* pager);
+
+// 叶节点压缩后写入区段；内部节点和压缩无收益的页原样存储。
+// 每次都写到新区段，不覆盖旧区段：落盘的页映射在下次写出前一直指向旧区段
+void pager_write_extent(Pager* pager, uint32_t page_num) {
+    void* page = pager->pages[page_num];
+    uint8_t buffer[PAGE_SIZE];
+    uint32_t length = 0;
+    if (get_node_type(page) == NODE_LEAF) {
+        length = lz_compress(page, PAGE_SIZE, buffer, PAGE_SIZE - 1);
+    }
+    void* source = buffer;
+    if (length == 0) {
+        length = PAGE_SIZE;
+        source = page;
+    }
+
+    PageMapEntry* entry = &pager->page_map[page_num];
+    if (entry->length != 0 && pager->num_released_extents == TABLE_MAX_PAGES) {
+        // 待释放列表满了，先写出页映射让这些区段可以复用
+        pager_write_page_map(pager);
+    }
+    uint32_t offset = pager_allocate_extent(pager, extent_capacity(length));
+    ssize_t bytes_written = pwrite(pager->file_descriptor, source, length, offset);
+    if (bytes_written != length) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (entry->length != 0) {
+        PageMapEntry* released = &pager->released_extents[pager->num_released_extents++];
+        released->offset = entry->offset;
+        released->length = extent_capacity(entry->length);
+    }
+    entry->offset = offset;
+    entry->length = length;
+}
+
+void pager_sync(Pager* pager);
+
+// 页映射区紧跟在元数据页之后。
+// 先让区段落盘再写页映射，页映射落盘之后旧区段才能复用，文件末尾才能截断
+void pager_write_page_map(Pager* pager) {
+    pager_sync(pager);
+    off_t offset = (off_t)META_PAGE_COUNT * PAGE_SIZE;
+    ssize_t bytes_written = pwrite(pager->file_descriptor, pager->page_map,
+                                   sizeof(pager->page_map), offset);
+    if (bytes_written != sizeof(pager->page_map)) {
+        printf("Error writing page map: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager_sync(pager);
+
+    for (uint32_t i = 0; i < pager->num_released_extents; i++) {
+        pager_free_extent(pager, pager->released_extents[i].offset, pager->released_extents[i].length);
+    }
+    pager->num_released_extents = 0;
+    // 末尾的区段被释放后文件随之收缩
+    if (ftruncate(pager->file_descriptor, pager->extent_end) == -1) {
+        printf("Error truncating db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int compare_page_nums(const void* a, const void* b) {
+    uint32_t left = *(const uint32_t*)a;
+    uint32_t right = *(const uint32_t*)b;
+    return (left > right) - (left < right);
+}
+
+int compare_extents(const void* a, const void* b) {
+    const PageMapEntry* left = a;
+    const PageMapEntry* right = b;
+    return (left->offset > right->offset) - (left->offset < right->offset);
+}
+
+// 压缩区段的偏移和长度不按块对齐，压缩文件总是走内核页缓存
+void pager_disable_direct_io(Pager* pager) {
+    if (pager->direct) {
+        fcntl(pager->file_descriptor, F_SETFL, fcntl(pager->file_descriptor, F_GETFL) & ~O_DIRECT);
+        pager->direct = false;
+    }
+}
+
+// 读取页映射，已用区段之间的空隙即为空闲区段
+void pager_load_page_map(Pager* pager) {
+    pager->compressed = true;
+    pager->extent_end = (META_PAGE_COUNT + PAGE_MAP_PAGES) * PAGE_SIZE;
+    pager->num_free_extents = 0;
+    ssize_t bytes_read = pread(pager->file_descriptor, pager->page_map, sizeof(pager->page_map),
+                               (off_t)META_PAGE_COUNT * PAGE_SIZE);
+    if (bytes_read != sizeof(pager->page_map)) {
+        printf("Db file has no page map. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    PageMapEntry used[TABLE_MAX_PAGES];
+    uint32_t num_used = 0;
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        if (pager->page_map[i].length != 0) {
+            used[num_used].offset = pager->page_map[i].offset;
+            used[num_used].length = extent_capacity(pager->page_map[i].length);
+            num_used++;
+        }
+    }
+    qsort(used, num_used, sizeof(PageMapEntry), compare_extents);
+    for (uint32_t i = 0; i < num_used; i++) {
+        if (used[i].offset > pager->extent_end) {
+            pager->free_extents[pager->num_free_extents].offset = pager->extent_end;
+            pager->free_extents[pager->num_free_extents].length = used[i].offset - pager->extent_end;
+            pager->num_free_extents++;
+        }
+        pager->extent_end = used[i].offset + used[i].length;
+    }
+}
+
+// 获取页面
+void* get_page(Pager* pager, uint32_t page_num) {
+    if (page_num >= TABLE_MAX_PAGES) {
+        printf("Tried to fetch page number out of bounds. %d >= %d\n",
+               page_num, TABLE_MAX_PAGES);
+        exit(EXIT_FAILURE);
+    }
+    atomic_store_explicit(&pager->referenced[page_num], true, memory_order_relaxed);
+
+    if (pager->pages[page_num] == NULL) {
+        // 缓存未命中，使用该页的页框
+        void* page = pager->frames + page_num * PAGE_SIZE;
+        if (pager->compressed && page_num >= META_PAGE_COUNT) {
+            pager_read_extent(pager, page_num, page);
+            pager->pages[page_num] = page;
+            if (page_num >= pager->num_pages) {
+                pager->num_pages = page_num + 1;
+            }
+            return page;
+        }
+        // 文件范围之外的页是空白页（页框初始为零），稍后将缓存刷新到磁盘时，该页面将被添加到文件中。
+        // 文件内的页必须完整读满一页，O_DIRECT 下的短读也按错误处理
+        if (page_num < pager->file_length / PAGE_SIZE &&
+            pread(pager->file_descriptor, page, PAGE_SIZE, (off_t)page_num * PAGE_SIZE) != PAGE_SIZE) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->pages[page_num] = page;
+        if (page_num >= pager->num_pages) {
+            pager->num_pages = page_num + 1;
+        }
+    }
+
+    return pager->pages[page_num];
+}
+
+// 为一批按页号排序的页发出预读提示后立即返回，内核在后台并发读入页缓存。
+// 压缩文件提示各自的区段；O_DIRECT 绕过页缓存，提示没有意义；快照读者的共享映射另外提示。
+void pager_advise(Pager* pager, uint32_t* page_nums, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t first = page_nums[i];
+        uint32_t last = first;
+        while (i + 1 < count && page_nums[i + 1] <= last + 1) {
+            last = page_nums[++i];
+        }
+        if (pager->compressed) {
+            for (uint32_t page_num = first; page_num <= last; page_num++) {
+                PageMapEntry* entry = &pager->page_map[page_num];
+                if (entry->length != 0) {
+                    posix_fadvise(pager->file_descriptor, entry->offset, entry->length, POSIX_FADV_WILLNEED);
+                }
+            }
+        } else if (!pager->direct) {
+            posix_fadvise(pager->file_descriptor, (off_t)first * PAGE_SIZE, (off_t)(last - first + 1) * PAGE_SIZE,
+                          POSIX_FADV_WILLNEED);
+        }
+        if (pager->map != NULL) {
+            madvise(pager->map + first * PAGE_SIZE, (last - first + 1) * PAGE_SIZE, MADV_WILLNEED);
+        }
+    }
+}
+
+// 一次读入一批未缓存的页：按页号排序后相邻的页合成一次 pread 直接读进页框。
+// 读之前先为每一段发出预读提示，内核并发完成这些读取，不必等前一页读完再发下一页。
+void pager_prefetch(Pager* pager, uint32_t* page_nums, uint32_t count) {
+    uint32_t* missing = malloc(count * sizeof(uint32_t));
+    uint32_t num_missing = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (page_nums[i] >= META_PAGE_COUNT && page_nums[i] < TABLE_MAX_PAGES &&
+            pager->pages[page_nums[i]] == NULL) {
+            missing[num_missing++] = page_nums[i];
+        }
+    }
+    qsort(missing, num_missing, sizeof(uint32_t), compare_page_nums);
+    pager_advise(pager, missing, num_missing);
+
+    // 压缩文件的页在变长区段里，逐页读入并解压
+    if (pager->compressed) {
+        for (uint32_t i = 0; i < num_missing; i++) {
+            uint32_t page_num = missing[i];
+            if (pager->pages[page_num] == NULL) {
+                pager_read_extent(pager, page_num, pager->frames + page_num * PAGE_SIZE);
+                pager->pages[page_num] = pager->frames + page_num * PAGE_SIZE;
+            }
+            if (page_num >= pager->num_pages) {
+                pager->num_pages = page_num + 1;
+            }
+        }
+        free(missing);
+        return;
+    }
+
+    // 文件末尾之外的页是空白页，留给 get_page 处理；其余按连续的页号分段
+    uint32_t file_pages = pager->file_length / PAGE_SIZE;
+    uint32_t* run_firsts = malloc(num_missing * sizeof(uint32_t));
+    uint32_t* run_lasts = malloc(num_missing * sizeof(uint32_t));
+    uint32_t num_runs = 0;
+    for (uint32_t i = 0; i < num_missing && missing[i] < file_pages; i++) {
+        if (num_runs > 0 && missing[i] <= run_lasts[num_runs - 1] + 1) {
+            run_lasts[num_runs - 1] = missing[i];
+            continue;
+        }
+        run_firsts[num_runs] = missing[i];
+        run_lasts[num_runs] = missing[i];
+        num_runs++;
+    }
+    for (uint32_t run = 0; run < num_runs; run++) {
+        uint32_t first = run_firsts[run];
+        uint32_t last = run_lasts[run];
+        ssize_t length = (last - first + 1) * PAGE_SIZE;
+        if (pread(pager->file_descriptor, pager->frames + first * PAGE_SIZE, length, (off_t)first * PAGE_SIZE) !=
+            length) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        for (uint32_t page_num = first; page_num <= last; page_num++) {
+            pager->pages[page_num] = pager->frames + page_num * PAGE_SIZE;
+        }
+        if (last >= pager->num_pages) {
+            pager->num_pages = last + 1;
+        }
+    }
+    free(run_firsts);
+    free(run_lasts);
+    free(missing);
+}
+
+void pager_flush(Pager* pager, uint32_t page_num) {
+    if (pager->pages[page_num] == NULL) {
+        printf("Tried to flush null page\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pager->compressed && page_num >= META_PAGE_COUNT) {
+        pager_write_extent(pager, page_num);
+        return;
+    }
+
+    ssize_t bytes_written = pwrite(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE,
+                                   (off_t)page_num * PAGE_SIZE);
+    if (bytes_written != PAGE_SIZE) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void pager_sync(Pager* pager) {
+    if (fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// 改名或删除文件后同步所在目录，目录项的变化才算落盘
+void sync_directory(const char* path) {
+    char* directory = strdup(path);
+    char* slash = strrchr(directory, '/');
+    if (slash == NULL) {
+        strcpy(directory, ".");
+    } else if (slash == directory) {
+        slash[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd == -1 || fsync(fd) == -1) {
+        printf("Error syncing directory: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    free(directory);
+}
+
+void pager_mark_dirty(Pager* pager, uint32_t page_num) {
+    if (pager->backup != NULL && page_num < pager->backup->next_page) {
+        pager->backup->recopy[page_num] = true;
+    }
+    if (!pager->dirty[page_num]) {
+        pager->dirty[page_num] = true;
+        pager->dirty_pages[pager->num_dirty_pages++] = page_num;
+    }
+}
+
+// 还能分配的页数：空闲页加上文件尚未用到的页
+uint32_t table_num_available_pages(Table* table) {
+    Pager* pager = table->pager;
+    return pager->num_free_pages + (TABLE_MAX_PAGES - pager->num_pages);
+}
+
+// 分配一个新页并记为本事务写过
+uint32_t table_allocate_page(Table* table) {
+    uint32_t page_num = get_unused_page_num(table->pager);
+    get_page(table->pager, page_num);
+    pager_mark_dirty(table->pager, page_num);
+    return page_num;
+}
+
+// 写时复制：返回 page_num 在当前事务中可写的版本。
+// 就地模式下直接返回原页；影子分页模式下，本事务尚未写过的页被复制到新页，
+// 旧页挂到待回收列表，等不再有快照引用它时才能复用。
+uint32_t table_touch_page(Table* table, uint32_t page_num) {
+    Pager* pager = table->pager;
+    if (!(table->flags & META_FLAG_COW) || pager->dirty[page_num]) {
+        pager_mark_dirty(pager, page_num);
+        return page_num;
+    }
+    uint32_t new_page_num = table_allocate_page(table);
+    memcpy(get_page(pager, new_page_num), get_page(pager, page_num), PAGE_SIZE);
+    pager->pending_pages[pager->num_pending_pages] = page_num;
+    pager->pending_txn_ids[pager->num_pending_pages] = atomic_load(&table->committed_txn_id) + 1;
+    pager->num_pending_pages++;
+    return new_page_num;
+}
+
+// 待回收页只有在所有活跃快照都不早于释放它的事务时才能复用
+void table_reclaim_pages(Table* table) {
+    Pager* pager = table->pager;
+    uint64_t oldest_txn_id = atomic_load(&table->committed_txn_id);
+    for (uint32_t i = 0; i < MAX_SNAPSHOT_READERS; i++) {
+        uint64_t txn_id = atomic_load(&table->readers[i]);
+        if (txn_id != 0 && txn_id < oldest_txn_id) {
+            oldest_txn_id = txn_id;
+        }
+    }
+
+    uint32_t num_pending = 0;
+    for (uint32_t i = 0; i < pager->num_pending_pages; i++) {
+        if (pager->pending_txn_ids[i] <= oldest_txn_id) {
+            pager->free_pages[pager->num_free_pages++] = pager->pending_pages[i];
+        } else {
+            pager->pending_pages[num_pending] = pager->pending_pages[i];
+            pager->pending_txn_ids[num_pending] = pager->pending_txn_ids[i];
+            num_pending++;
+        }
+    }
+    pager->num_pending_pages = num_pending;
+}
+
+uint32_t fnv_hash(uint32_t hash, const uint8_t* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// FNV-1a，覆盖 checksum 之前的全部字段和空闲页表
+uint32_t meta_checksum(void* page) {
+    MetaPage* meta = page;
+    uint32_t hash = fnv_hash(2166136261u, page, offsetof(MetaPage, checksum));
+    if (meta->version >= 2) {
+        hash = fnv_hash(hash, (uint8_t*)meta_free_pages(page), meta->num_free_pages * sizeof(uint32_t));
+    }
+    if (meta->flags & META_FLAG_SCHEMA) {
+        hash = fnv_hash(hash, (uint8_t*)meta_schema(page), sizeof(Schema));
+    }
+    return hash;
+}
+
+// 读取两份元数据页，返回校验通过且事务号较大的一份
+bool table_read_meta(Table* table, MetaPage* meta) {
+    bool found = false;
+    for (uint32_t slot = 0; slot < META_PAGE_COUNT && slot < table->pager->num_pages; slot++) {
+        void* page = get_page(table->pager, slot);
+        MetaPage candidate;
+        memcpy(&candidate, page, sizeof(MetaPage));
+        if (candidate.magic != META_MAGIC || candidate.version < 1 || candidate.version > META_VERSION ||
+            candidate.num_free_pages > TABLE_MAX_PAGES || candidate.checksum != meta_checksum(page)) {
+            continue;
+        }
+        if (!found || candidate.txn_id > meta->txn_id) {
+            *meta = candidate;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void table_fill_meta_page(Table* table, uint64_t txn_id, void* page) {
+    MetaPage meta;
+    memset(&meta, 0, sizeof(MetaPage));
+    meta.magic = META_MAGIC;
+    meta.version = META_VERSION;
+    meta.flags = table->flags;
+    meta.root_page_num = table->root_page_num;
+    meta.num_pages = table->pager->num_pages;
+    meta.txn_id = txn_id;
+    memset(page, 0, PAGE_SIZE);
+    // 待回收的页只被本进程中的快照引用，重新打开后都是空闲的
+    Pager* pager = table->pager;
+    uint32_t* free_pages = meta_free_pages(page);
+    memcpy(free_pages, pager->free_pages, pager->num_free_pages * sizeof(uint32_t));
+    memcpy(free_pages + pager->num_free_pages, pager->pending_pages, pager->num_pending_pages * sizeof(uint32_t));
+    meta.num_free_pages = pager->num_free_pages + pager->num_pending_pages;
+    if (table->flags & META_FLAG_SCHEMA) {
+        memcpy(meta_schema(page), &table->schema, sizeof(Schema));
+    }
+    memcpy(page, &meta, sizeof(MetaPage));
+    ((MetaPage*)page)->checksum = meta_checksum(page);
+}
+
+// 写入事务 txn_id 对应的元数据页，两个槽位轮流使用，写坏的一份不影响另一份
+void table_write_meta(Table* table, uint64_t txn_id) {
+    uint32_t slot = txn_id % META_PAGE_COUNT;
+    table_fill_meta_page(table, txn_id, get_page(table->pager, slot));
+    pager_flush(table->pager, slot);
+}
+
+// 提交当前写事务。
+// 影子分页模式：刷新本事务写过的页 -> fsync -> 写另一份元数据页 -> fsync，之后新根才对读者可见。
+// 就地模式下页面在关闭时统一刷盘，这里什么也不做。
+void table_commit(Table* table) {
+    Pager* pager = table->pager;
+    if (!(table->flags & META_FLAG_COW) || pager->num_dirty_pages == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < pager->num_dirty_pages; i++) {
+        uint32_t page_num = pager->dirty_pages[i];
+        pager_flush(pager, page_num);
+        pager->dirty[page_num] = false;
+    }
+    pager->num_dirty_pages = 0;
+    pager_sync(pager);
+
+    uint64_t txn_id = atomic_load(&table->committed_txn_id) + 1;
+    table_write_meta(table, txn_id);
+    pager_sync(pager);
+
+    atomic_store(&table->committed_root_page_num, table->root_page_num);
+    atomic_store(&table->committed_txn_id, txn_id);
+    table_reclaim_pages(table);
+}
+
+void free_backup(Backup* backup) {
+    free(backup->dest);
+    free(backup->temp_path);
+    free(backup->chunk);
+    free(backup);
+}
+
+bool table_flush_memtable(Table* table);
+
+// 在线热备份：按块顺序复制页面，期间写入照常进行。
+// 已复制过又被改写的页记下来，最后一步统一重新复制并写入新的元数据页，
+// 这一步中间没有写入穿插，得到的是该时刻的一致镜像。
+// 目标先写到 <dest>.tmp，完成后再改名，半途失败不会留下残缺的备份。
+bool table_backup_begin(Table* table, const char* dest) {
+    Pager* pager = table->pager;
+    if (pager->backup != NULL) {
+        fprintf(output_stream, "Backup already in progress.\n");
+        return false;
+    }
+    // 内存表中的行先合并进树，备份才包含它们
+    table_flush_memtable(table);
+    Backup* backup = malloc(sizeof(Backup));
+    memset(backup, 0, sizeof(Backup));
+    backup->dest = strdup(dest);
+    backup->temp_path = malloc(strlen(dest) + 5);
+    sprintf(backup->temp_path, "%s.tmp", dest);
+    backup->file_descriptor = open(backup->temp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (backup->file_descriptor == -1) {
+        fprintf(output_stream, "Unable to open backup file.\n");
+        free_backup(backup);
+        return false;
+    }
+    // O_DIRECT 模式下直接读进这块缓冲，需要按页对齐
+    backup->chunk = aligned_alloc(PAGE_SIZE, BACKUP_CHUNK_PAGES * PAGE_SIZE);
+    pager->backup = backup;
+    return true;
+}
+
+// 取 page_num 当前的内容：缓存中的页以内存为准，否则从数据文件读
+void backup_read_page(Pager* pager, uint32_t page_num, void* page) {
+    if (pager->pages[page_num] != NULL) {
+        memcpy(page, pager->pages[page_num], PAGE_SIZE);
+        return;
+    }
+    memset(page, 0, PAGE_SIZE);
+    if (pager->compressed && page_num >= META_PAGE_COUNT) {
+        pager_read_extent(pager, page_num, page);
+        return;
+    }
+    if (pread(pager->file_descriptor, page, PAGE_SIZE, (off_t)page_num * PAGE_SIZE) == -1) {
+        printf("Error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void backup_write(Backup* backup, const void* data, uint32_t length, uint32_t page_num) {
+    ssize_t bytes_written = pwrite(backup->file_descriptor, data, length, (off_t)page_num * PAGE_SIZE);
+    if (bytes_written != length) {
+        printf("Error writing backup: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void table_backup_abort(Table* table) {
+    Backup* backup = table->pager->backup;
+    if (backup == NULL) {
+        return;
+    }
+    close(backup->file_descriptor);
+    unlink(backup->temp_path);
+    free_backup(backup);
+    table->pager->backup = NULL;
+}
+
+// 重新复制被改写的页，写入元数据页，落盘后改名。备份文件总是按整页存储，
+// 压缩数据库的备份是未压缩的普通文件，可以直接打开。
+void table_backup_finish(Table* table) {
+    Pager* pager = table->pager;
+    Backup* backup = pager->backup;
+    uint8_t* page = backup->chunk;
+    for (uint32_t page_num = META_PAGE_COUNT; page_num < backup->next_page; page_num++) {
+        if (backup->recopy[page_num]) {
+            backup_read_page(pager, page_num, page);
+            backup_write(backup, page, PAGE_SIZE, page_num);
+        }
+    }
+
+    uint64_t txn_id = atomic_load(&table->committed_txn_id) + 1;
+    for (uint32_t slot = 0; slot < META_PAGE_COUNT; slot++) {
+        memset(page, 0, PAGE_SIZE);
+        if (slot == txn_id % META_PAGE_COUNT) {
+            table_fill_meta_page(table, txn_id, page);
+            ((MetaPage*)page)->flags &= ~META_FLAG_COMPRESSED;
+            ((MetaPage*)page)->checksum = meta_checksum(page);
+        }
+        backup_write(backup, page, PAGE_SIZE, slot);
+    }
+    if (fdatasync(backup->file_descriptor) == -1 || rename(backup->temp_path, backup->dest) == -1) {
+        printf("Error finishing backup: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    close(backup->file_descriptor);
+    free_backup(backup);
+    pager->backup = NULL;
+}
+
+// 复制下一块连续的页；全部复制完时收尾并返回 true
+bool table_backup_step(Table* table) {
+    Pager* pager = table->pager;
+    Backup* backup = pager->backup;
+    if (backup->next_page < META_PAGE_COUNT) {
+        backup->next_page = META_PAGE_COUNT;
+    }
+    if (backup->next_page >= pager->num_pages) {
+        table_backup_finish(table);
+        return true;
+    }
+
+    uint32_t count = pager->num_pages - backup->next_page;
+    if (count > BACKUP_CHUNK_PAGES) {
+        count = BACKUP_CHUNK_PAGES;
+    }
+    uint8_t* chunk = backup->chunk;
+    if (!pager->compressed) {
+        // 整块一次读入，再用缓存中较新的页覆盖
+        memset(chunk, 0, count * PAGE_SIZE);
+        if (pread(pager->file_descriptor, chunk, count * PAGE_SIZE,
+                  (off_t)backup->next_page * PAGE_SIZE) == -1) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page_num = backup->next_page + i;
+        if (pager->compressed || pager->pages[page_num] != NULL) {
+            backup_read_page(pager, page_num, chunk + i * PAGE_SIZE);
+        }
+    }
+    backup_write(backup, chunk, count * PAGE_SIZE, backup->next_page);
+    backup->next_page += count;
+    return false;
+}
+
+// 一次完成整个备份
+bool table_backup(Table* table, const char* dest) {
+    if (!table_backup_begin(table, dest)) {
+        return false;
+    }
+    while (!table_backup_step(table)) {
+    }
+    return true;
+}
+
+// 热页文件与数据库文件并列：<数据库文件>.hot
+char* hot_pages_path(const char* filename) {
+    char* path = malloc(strlen(filename) + 5);
+    sprintf(path, "%s.hot", filename);
+    return path;
+}
+
+// 热页文件的头部，随后是按页号排序的页号表
+typedef struct {
+    uint32_t magic;
+    uint32_t num_pages;
+    uint32_t checksum; // 页号表的 FNV 哈希
+} HotPagesHeader;
+
+// 记下本次会话访问过的页和尚未预热到的页。热页表只是提示，写失败时跳过即可
+void pager_save_hot_pages(Pager* pager) {
+    bool hot[TABLE_MAX_PAGES] = {false};
+    for (uint32_t i = META_PAGE_COUNT; i < pager->num_pages; i++) {
+        hot[i] = atomic_load_explicit(&pager->referenced[i], memory_order_relaxed);
+    }
+    for (uint32_t i = pager->next_warm_page; i < pager->num_warm_pages; i++) {
+        hot[pager->warm_pages[i]] = true;
+    }
+    uint32_t pages[TABLE_MAX_PAGES];
+    HotPagesHeader header = {HOT_PAGES_MAGIC, 0, 0};
+    for (uint32_t i = META_PAGE_COUNT; i < pager->num_pages; i++) {
+        if (hot[i]) {
+            pages[header.num_pages++] = i;
+        }
+    }
+    header.checksum = fnv_hash(2166136261u, (uint8_t*)pages, header.num_pages * sizeof(uint32_t));
+
+    char* path = hot_pages_path(pager->filename);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd != -1) {
+        ssize_t length = header.num_pages * sizeof(uint32_t);
+        bool written = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+                       write(fd, pages, length) == length;
+        close(fd);
+        // 写了一半的热页表不留下
+        if (!written) {
+            unlink(path);
+        }
+    }
+    free(path);
+}
+
+// 读入上次关闭时的热页表并立即发出预读提示，内核在后台读入页缓存；
+// 之后由 pager_warm_step 在请求之间分块读进页框。文件缺失或损坏时不预热
+void pager_load_hot_pages(Pager* pager) {
+    char* path = hot_pages_path(pager->filename);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1) {
+        return;
+    }
+    HotPagesHeader header;
+    uint32_t* pages = malloc(TABLE_MAX_PAGES * sizeof(uint32_t));
+    bool valid = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && header.magic == HOT_PAGES_MAGIC &&
+                 header.num_pages <= TABLE_MAX_PAGES &&
+                 read(fd, pages, header.num_pages * sizeof(uint32_t)) == (ssize_t)(header.num_pages * sizeof(uint32_t)) &&
+                 fnv_hash(2166136261u, (uint8_t*)pages, header.num_pages * sizeof(uint32_t)) == header.checksum;
+    close(fd);
+    // 文件之后可能被整理或截断过，超出范围的页号直接丢弃
+    uint32_t num_pages = 0;
+    for (uint32_t i = 0; valid && i < header.num_pages; i++) {
+        if (pages[i] >= META_PAGE_COUNT && pages[i] < pager->num_pages &&
+            (num_pages == 0 || pages[i] > pages[num_pages - 1])) {
+            pages[num_pages++] = pages[i];
+        }
+    }
+    if (num_pages == 0) {
+        free(pages);
+        return;
+    }
+    pager->warm_pages = pages;
+    pager->num_warm_pages = num_pages;
+    pager->next_warm_page = 0;
+    pager_advise(pager, pages, num_pages);
+}
+
+// 预热一块：热页表中接下来的 WARM_CHUNK_PAGES 页一次读进页框，相邻的页合成一次顺序读。
+// 返回是否已全部完成
+bool pager_warm_step(Pager* pager) {
+    if (pager->warm_pages == NULL) {
+        return true;
+    }
+    uint32_t count = pager->num_warm_pages - pager->next_warm_page;
+    if (count > WARM_CHUNK_PAGES) {
+        count = WARM_CHUNK_PAGES;
+    }
+    pager_prefetch(pager, pager->warm_pages + pager->next_warm_page, count);
+    pager->next_warm_page += count;
+    if (pager->next_warm_page < pager->num_warm_pages) {
+        return false;
+    }
+    free(pager->warm_pages);
+    pager->warm_pages = NULL;
+    pager->num_warm_pages = 0;
+    pager->next_warm_page = 0;
+    return true;
+}
+
+// 释放页框区和映射并关闭文件，不刷写任何页
+void pager_close(Pager* pager) {
+    free(pager->warm_pages);
+    munmap(pager->frames, TABLE_MAX_PAGES * PAGE_SIZE);
+    if (pager->map != NULL) {
+        munmap(pager->map, TABLE_MAX_PAGES * PAGE_SIZE);
+    }
+    // 关闭文件
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+        printf("Error closing db file.\n");
+        exit(EXIT_FAILURE);
+    }
+    free(pager->filename);
+    free(pager);
+}
+
+void table_scan_finish(Table* table, bool print);
+bool table_merge_memtable(Table* table);
+void partitions_close(Table* table);
+
+void db_close(Table* table) {
+    if (table->partitions != NULL) {
+        partitions_close(table);
+        return;
+    }
+    table_scan_finish(table, false);
+    table_backup_abort(table);
+    if (table->memtable != NULL) {
+        // 写入时已确认过全部行放得下，这里只有备份或快照占着原文件时才会失败。
+        // 此时不刷写任何页就退出，就地模式下文件保持打开前的样子
+        if (!table_merge_memtable(table)) {
+            printf("Error: Table full, %d ingested rows could not be written.\n", table->memtable->num_rows);
+            exit(EXIT_FAILURE);
+        }
+        free_memtable(table->memtable);
+    }
+    // 合并时可能整体重写过，换成了新文件的页缓存
+    Pager* pager = table->pager;
+    if (table->flags & META_FLAG_COW) {
+        table_commit(table);
+    } else {
+        // 就地模式：先刷写全部缓存页，最后写元数据页
+        for (uint32_t i = 0; i < pager->num_pages; i++) {
+            if (pager->pages[i] != NULL) {
+                pager_flush(pager, i);
+            }
+        }
+        if (pager->compressed) {
+            pager_write_page_map(pager);
+        }
+        pager_sync(pager);
+        table_write_meta(table, atomic_load(&table->committed_txn_id) + 1);
+        // 整理和分裂写出的新文件关闭后就会替换原文件，元数据页必须已经落盘
+        pager_sync(pager);
+    }
+
+    if (table->warm) {
+        pager_save_hot_pages(pager);
+    }
+    pager_close(pager);
+    // 释放table
+    free(table);
+}
+
+// 行宽和叶节点容量按当前表结构计算
+void print_constants(Table* table) {
+    uint32_t row_size = table_row_size(table);
+    fprintf(output_stream, "ROW_SIZE: %d\n", row_size);
+    fprintf(output_stream, "COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+    fprintf(output_stream, "LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+    fprintf(output_stream, "LEAF_NODE_CELL_SIZE: %d\n", leaf_node_cell_size(row_size));
+    fprintf(output_stream, "LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+    fprintf(output_stream, "LEAF_NODE_MAX_CELLS: %d\n", leaf_node_max_cells(row_size));
+}
+
+// B+树可视化
+void indent(uint32_t level) {
+    for (uint32_t i = 0; i < level; i++) {
+        fprintf(output_stream, "  ");
+    }
+}
+
+void print_tree(Table* table, uint32_t page_num, uint32_t indentation_level) {
+    void* node = get_page(table->pager, page_num);
+    uint32_t num_keys, child;
+    bool string_key = table->flags & META_FLAG_STRING_KEY;
+    Key key;
+
+    switch (get_node_type(node)) {
+        case (NODE_LEAF):
+            num_keys = *leaf_node_num_cells(node);
+            indent(indentation_level);
+            fprintf(output_stream, "- leaf (size %d)\n", num_keys);
+            for (uint32_t i = 0; i < num_keys; i++) {
+                indent(indentation_level + 1);
+                if (string_key) {
+                    string_leaf_key(node, i, &key);
+                    fprintf(output_stream, "- %.*s\n", key.length, key.data);
+                } else {
+                    fprintf(output_stream, "- %d\n", *leaf_node_key(node, i, table_row_size(table)));
+                }
+            }
+            break;
+        case (NODE_INTERNAL):
+            num_keys = *internal_node_num_keys(node);
+            indent(indentation_level);
+            fprintf(output_stream, "- internal (size %d)\n", num_keys);
+            if (num_keys > 0) {
+                for (uint32_t i = 0; i < num_keys; i++) {
+                    child = *internal_node_child(node, i);
+                    print_tree(table, child, indentation_level + 1);
+
+                    indent(indentation_level + 1);
+                    if (string_key) {
+                        string_internal_key(node, i, &key);
+                        fprintf(output_stream, "- key %.*s\n", key.length, key.data);
+                    } else {
+                        fprintf(output_stream, "- key %d\n", *internal_node_key(node, i));
+                    }
+                }
+                child = *internal_node_right_child(node);
+                print_tree(table, child, indentation_level + 1);
+            }
+            break;
+    }
+}
+
+
+void table_scan_begin(Table* table);
+bool table_vacuum(Table* table, uint32_t fill_percent);
+void partitions_print(Table* table);
+void partitions_print_tree(Table* table);
+void partitions_vacuum(Table* table, uint32_t fill_percent);
+void partitions_split_at(Table* table, uint32_t id);
+bool parse_id(const char* string, uint32_t* id);
+
+// 处理元命令
+MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
+    if (strcmp(input_buffer->buffer, ".exit") == 0) {
+        db_close(table);
+        exit(EXIT_SUCCESS);
+    } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+        fprintf(output_stream, "Constants:\n");
+        print_constants(table);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+        fprintf(output_stream, "Tree:\n");
+        if (table->partitions != NULL) {
+            partitions_print_tree(table);
+        } else {
+            print_tree(table, table->root_page_num, 0);
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".schema") == 0) {
+        print_schema(&table->schema);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".partitions") == 0) {
+        if (table->partitions == NULL) {
+            fprintf(output_stream, "Table is not partitioned.\n");
+            return META_COMMAND_SUCCESS;
+        }
+        partitions_print(table);
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".split ", 7) == 0) {
+        // 在给定的 id 处把所在分区一分为二
+        uint32_t id;
+        if (table->partitions == NULL) {
+            fprintf(output_stream, "Table is not partitioned.\n");
+        } else if (!parse_id(input_buffer->buffer + 7, &id)) {
+            fprintf(output_stream, "ID must be a positive integer.\n");
+        } else {
+            partitions_split_at(table, id);
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".scan") == 0) {
+        table_scan_begin(table);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".scan wait") == 0) {
+        if (table->scan == NULL) {
+            fprintf(output_stream, "No scan running.\n");
+        } else {
+            table_scan_finish(table, true);
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".vacuum") == 0 ||
+               strncmp(input_buffer->buffer, ".vacuum ", 8) == 0) {
+        // 可选参数是叶节点的目标填充率（百分比），默认留一成空间给之后的插入
+        uint32_t fill_percent = DEFAULT_FILL_PERCENT;
+        if (input_buffer->buffer[7] == ' ') {
+            int value = atoi(input_buffer->buffer + 8);
+            if (value < 1 || value > 100) {
+                fprintf(output_stream, "Fill factor must be between 1 and 100.\n");
+                return META_COMMAND_SUCCESS;
+            }
+            fill_percent = value;
+        }
+        if (table->partitions != NULL) {
+            partitions_vacuum(table, fill_percent);
+        } else {
+            table_vacuum(table, fill_percent);
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".backup ", 8) == 0) {
+        const char* dest = input_buffer->buffer + 8;
+        if (table->partitions != NULL) {
+            fprintf(output_stream, "Backup is not supported for partitioned tables.\n");
+            return META_COMMAND_SUCCESS;
+        }
+        if (!table_backup_begin(table, dest)) {
+            return META_COMMAND_SUCCESS;
+        }
+        // 服务模式下由事件循环分步推进，完成后再回复
+        if (backup_in_background) {
+            return META_COMMAND_SUCCESS;
+        }
+        while (!table_backup_step(table)) {
+        }
+        fprintf(output_stream, "Backup complete.\n");
+        return META_COMMAND_SUCCESS;
+    } else {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+}
+
+
+// 快照读者直接访问共享映射中已提交的页
+void* snapshot_page(Snapshot* snapshot, uint32_t page_num) {
+    atomic_store_explicit(&snapshot->table->pager->referenced[page_num], true, memory_order_relaxed);
+    return snapshot->table->pager->map + page_num * PAGE_SIZE;
+}
+
+// 读取游标所在树的页面：快照游标读共享映射，其余走页缓存
+void* cursor_page(Cursor* cursor, uint32_t page_num) {
+    if (cursor->snapshot != NULL) {
+        return snapshot_page(cursor->snapshot, page_num);
+    }
+    return get_page(cursor->table->pager, page_num);
+}
+
+void leaf_node_find(Cursor* cursor, uint32_t page_num, uint32_t key) {
+    void* node = cursor_page(cursor, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    cursor->page_num = page_num;
+
+    // Binary search
+    uint32_t min_index = 0;
+    uint32_t one_past_max_index = num_cells;
+    while (one_past_max_index != min_index) {
+        uint32_t index = (min_index + one_past_max_index) / 2;
+        uint32_t key_at_index = *leaf_node_key(node, index, table_row_size(cursor->table));
+        if (key == key_at_index) {
+            cursor->cell_num = index;
+            return;
+        }
+        if (key < key_at_index) {
+            one_past_max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+
+    cursor->cell_num = min_index;
+}
+
+
+
+
+
+uint32_t internal_node_find_child(void* node, uint32_t key) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    /* Binary search to find index of child to search */
+    uint32_t min_index = 0;
+    uint32_t max_index = num_keys; /* there is one more child than key */
+
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        uint32_t key_to_right = *internal_node_key(node, index);
+        if (key_to_right >= key) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+uint32_t string_internal_node_find_child(void* node, Key* key) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    // 找第一个大于 key 的分隔键，等于分隔键的键属于右侧子树
+    uint32_t min_index = 0;
+    uint32_t max_index = num_keys;
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        Key separator;
+        string_internal_key(node, index, &separator);
+        if (compare_keys(key, &separator) < 0) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+void string_leaf_node_find(Cursor* cursor, uint32_t page_num, Key* key) {
+    void* node = cursor_page(cursor, page_num);
+    cursor->page_num = page_num;
+
+    uint32_t min_index = 0;
+    uint32_t one_past_max_index = *leaf_node_num_cells(node);
+    while (one_past_max_index != min_index) {
+        uint32_t index = (min_index + one_past_max_index) / 2;
+        Key key_at_index;
+        string_leaf_key(node, index, &key_at_index);
+        int result = compare_keys(key, &key_at_index);
+        if (result == 0) {
+            cursor->cell_num = index;
+            return;
+        }
+        if (result < 0) {
+            one_past_max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    cursor->cell_num = min_index;
+}
+
+Cursor* new_cursor(Table* table, Snapshot* snapshot) {
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->snapshot = snapshot;
+    cursor->end_of_table = false;
+    cursor->depth = 0;
+    return cursor;
+}
+
+// 记录下降路径上的一层：从内部节点 page_num 走向第 child_index 个子节点，返回子节点页号
+uint32_t cursor_push(Cursor* cursor, uint32_t page_num, uint32_t child_index) {
+    if (cursor->depth >= TREE_MAX_HEIGHT) {
+        printf("Tree is deeper than %d levels. Corrupt file.\n", TREE_MAX_HEIGHT);
+        exit(EXIT_FAILURE);
+    }
+    cursor->path[cursor->depth] = page_num;
+    cursor->child_index[cursor->depth] = child_index;
+    cursor->depth++;
+    return *internal_node_child(cursor_page(cursor, page_num), child_index);
+}
+
+// 从 root_page_num 下降到 key 所在的叶节点，沿途记录路径。
+// 分裂和写时复制都靠这条路径找父节点，节点本身不再需要父指针。
+Cursor* tree_find(Table* table, Snapshot* snapshot, uint32_t root_page_num, uint32_t key) {
+    Cursor* cursor = new_cursor(table, snapshot);
+    uint32_t page_num = root_page_num;
+    void* node = cursor_page(cursor, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = cursor_push(cursor, page_num, internal_node_find_child(node, key));
+        node = cursor_page(cursor, page_num);
+    }
+    leaf_node_find(cursor, page_num, key);
+    return cursor;
+}
+
+Cursor* string_tree_find(Table* table, Snapshot* snapshot, uint32_t root_page_num, Key* key) {
+    Cursor* cursor = new_cursor(table, snapshot);
+    uint32_t page_num = root_page_num;
+    void* node = cursor_page(cursor, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = cursor_push(cursor, page_num, string_internal_node_find_child(node, key));
+        node = cursor_page(cursor, page_num);
+    }
+    string_leaf_node_find(cursor, page_num, key);
+    return cursor;
+}
+
+// 沿最左路径下降到第一个叶节点，两种键类型通用
+Cursor* tree_start(Table* table, Snapshot* snapshot, uint32_t root_page_num) {
+    Cursor* cursor = new_cursor(table, snapshot);
+    uint32_t page_num = root_page_num;
+    void* node = cursor_page(cursor, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = cursor_push(cursor, page_num, 0);
+        node = cursor_page(cursor, page_num);
+    }
+    cursor->page_num = page_num;
+    cursor->cell_num = 0;
+    cursor->end_of_table = (*leaf_node_num_cells(node) == 0);
+    return cursor;
+}
+
+Cursor* table_find(Table* table, uint32_t key) {
+    return tree_find(table, NULL, table->root_page_num, key);
+}
+
+// 返回最小键的位置（最左边叶节点的起点）
+Cursor* table_start(Table* table) {
+    return tree_start(table, NULL, table->root_page_num);
+}
+
+// 沿最右路径下降到最后一个叶节点，停在最大键上
+Cursor* tree_end(Table* table, Snapshot* snapshot, uint32_t root_page_num) {
+    Cursor* cursor = new_cursor(table, snapshot);
+    uint32_t page_num = root_page_num;
+    void* node = cursor_page(cursor, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = cursor_push(cursor, page_num, *internal_node_num_keys(node));
+        node = cursor_page(cursor, page_num);
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    cursor->page_num = page_num;
+    cursor->cell_num = num_cells > 0 ? num_cells - 1 : 0;
+    cursor->end_of_table = (num_cells == 0);
+    return cursor;
+}
+
+// 按主键下降，停在第一个不小于 key 的位置，两种键类型通用
+Cursor* tree_seek(Table* table, Snapshot* snapshot, uint32_t root_page_num, Key* key) {
+    if (table->flags & META_FLAG_STRING_KEY) {
+        return string_tree_find(table, snapshot, root_page_num, key);
+    }
+    return tree_find(table, snapshot, root_page_num, key_as_id(key));
+}
+
+uint32_t tree_num_rows(Table* table, Snapshot* snapshot, uint32_t root_page_num) {
+    if (snapshot != NULL) {
+        return node_num_rows(snapshot_page(snapshot, root_page_num));
+    }
+    return node_num_rows(get_page(table->pager, root_page_num));
+}
+
+// 游标之前的行数：路径上每层左侧兄弟子树的行数之和，加上叶节点内的下标
+uint32_t cursor_rank(Cursor* cursor) {
+    uint32_t rank = cursor->cell_num;
+    for (uint32_t level = 0; level < cursor->depth; level++) {
+        void* node = cursor_page(cursor, cursor->path[level]);
+        for (uint32_t i = 0; i < cursor->child_index[level]; i++) {
+            rank += *internal_node_child_rows(node, i);
+        }
+    }
+    return rank;
+}
+
+// 打开快照：在读者表中登记事务号，写者此后不会复用该快照可达的页。
+// 读者全程不加锁，只通过读者表和写者协调；就地模式下不支持快照，返回 NULL。
+Snapshot* snapshot_open(Table* table) {
+    if (!(table->flags & META_FLAG_COW)) {
+        return NULL;
+    }
+    for (uint32_t slot = 0; slot < MAX_SNAPSHOT_READERS; slot++) {
+        uint64_t expected = 0;
+        uint64_t txn_id = atomic_load(&table->committed_txn_id);
+        if (!atomic_compare_exchange_strong(&table->readers[slot], &expected, txn_id)) {
+            continue;
+        }
+        // 登记之后再确认一次：写者可能在登记生效前又提交了新事务。
+        // 先读根页再读事务号，读到的根页至少和事务号一样新，登记得偏旧只会多保留一些页。
+        uint32_t root_page_num;
+        while (true) {
+            root_page_num = atomic_load(&table->committed_root_page_num);
+            uint64_t current_txn_id = atomic_load(&table->committed_txn_id);
+            if (current_txn_id == txn_id) {
+                break;
+            }
+            txn_id = current_txn_id;
+            atomic_store(&table->readers[slot], txn_id);
+        }
+
+        Snapshot* snapshot = malloc(sizeof(Snapshot));
+        snapshot->table = table;
+        snapshot->root_page_num = root_page_num;
+        snapshot->txn_id = txn_id;
+        snapshot->slot = slot;
+        return snapshot;
+    }
+    return NULL;
+}
+
+void snapshot_close(Snapshot* snapshot) {
+    atomic_store(&snapshot->table->readers[snapshot->slot], 0);
+    free(snapshot);
+}
+
+Cursor* snapshot_start(Snapshot* snapshot) {
+    return tree_start(snapshot->table, snapshot, snapshot->root_page_num);
+}
+
+
+// 获取指向光标所描述位置的指针
+void* cursor_value(Cursor* cursor) {
+    uint32_t page_num = cursor->page_num;
+    void* page = cursor_page(cursor, page_num);
+    if (cursor->table->flags & META_FLAG_STRING_KEY) {
+        return string_leaf_value(page, cursor->cell_num);
+    }
+    return leaf_node_value(page, cursor->cell_num, table_row_size(cursor->table));
+}
+
+// 键小于 key 的行数；inclusive 时也算上等于 key 的那一行
+uint32_t tree_rank(Table* table, Snapshot* snapshot, uint32_t root_page_num, Key* key, bool inclusive) {
+    Cursor* cursor = tree_seek(table, snapshot, root_page_num, key);
+    uint32_t rank = cursor_rank(cursor);
+    if (inclusive && cursor->cell_num < *leaf_node_num_cells(cursor_page(cursor, cursor->page_num))) {
+        Key found;
+        key_from_value(table->flags & META_FLAG_STRING_KEY, cursor_value(cursor), &found);
+        if (compare_keys(&found, key) == 0) {
+            rank++;
+        }
+    }
+    free(cursor);
+    return rank;
+}
+
+// 定位到按键序的第 position 行（从 0 开始）：每层按子树行数选出包含它的子节点，只需一次下降
+Cursor* tree_seek_position(Table* table, Snapshot* snapshot, uint32_t root_page_num, uint32_t position) {
+    Cursor* cursor = new_cursor(table, snapshot);
+    uint32_t page_num = root_page_num;
+    void* node = cursor_page(cursor, page_num);
+    cursor->page_num = page_num;
+    cursor->cell_num = 0;
+    if (position >= node_num_rows(node)) {
+        cursor->end_of_table = true;
+        return cursor;
+    }
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child = 0;
+        while (position >= *internal_node_child_rows(node, child)) {
+            position -= *internal_node_child_rows(node, child);
+            child++;
+        }
+        page_num = cursor_push(cursor, page_num, child);
+        node = cursor_page(cursor, page_num);
+    }
+    cursor->page_num = page_num;
+    cursor->cell_num = position;
+    return cursor;
+}
+
+// 预读即将下降的一批子节点：快照读者只提示共享映射，其余读进页缓存
+void tree_prefetch(Table* table, Snapshot* snapshot, uint32_t* page_nums, uint32_t count) {
+    if (snapshot == NULL) {
+        pager_prefetch(table->pager, page_nums, count);
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        madvise(table->pager->map + page_nums[i] * PAGE_SIZE, PAGE_SIZE, MADV_WILLNEED);
+    }
+}
+
+// 在以 page_num 为根的子树中查找已排序的 keys。内部节点把键按子节点分组，
+// 要访问的子节点先一起预读再逐个下降，每个节点只访问一次；
+// 叶节点内顺着单元格向右归并，同一叶节点上连续的键不再重复查找。
+void multi_get_node(Cursor* cursor, uint32_t page_num, Key* keys, uint32_t num_keys, void** values) {
+    bool string_key = cursor->table->flags & META_FLAG_STRING_KEY;
+    uint32_t row_size = table_row_size(cursor->table);
+    void* node = cursor_page(cursor, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t cell_num = 0;
+        for (uint32_t i = 0; i < num_keys; i++) {
+            int result = 1;
+            for (; cell_num < num_cells; cell_num++) {
+                Key cell_key;
+                if (string_key) {
+                    string_leaf_key(node, cell_num, &cell_key);
+                } else {
+                    key_from_id(*leaf_node_key(node, cell_num, row_size), &cell_key);
+                }
+                result = compare_keys(&cell_key, &keys[i]);
+                if (result >= 0) {
+                    break;
+                }
+            }
+            values[i] = NULL;
+            if (cell_num < num_cells && result == 0) {
+                values[i] = string_key ? string_leaf_value(node, cell_num) : leaf_node_value(node, cell_num, row_size);
+            }
+        }
+        return;
+    }
+
+    uint32_t* children = malloc(num_keys * sizeof(uint32_t));
+    uint32_t* starts = malloc((num_keys + 1) * sizeof(uint32_t));
+    uint32_t num_groups = 0;
+    uint32_t last_child = UINT32_MAX;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        uint32_t child = string_key ? string_internal_node_find_child(node, &keys[i])
+                                    : internal_node_find_child(node, key_as_id(&keys[i]));
+        if (child != last_child) {
+            children[num_groups] = *internal_node_child(node, child);
+            starts[num_groups] = i;
+            num_groups++;
+            last_child = child;
+        }
+    }
+    starts[num_groups] = num_keys;
+    tree_prefetch(cursor->table, cursor->snapshot, children, num_groups);
+    for (uint32_t group = 0; group < num_groups; group++) {
+        multi_get_node(cursor, children[group], keys + starts[group], starts[group + 1] - starts[group],
+                       values + starts[group]);
+    }
+    free(children);
+    free(starts);
+}
+
+// 影子分页下叶节点被复制到新页号后，左兄弟的 next_leaf 仍指向旧页，
+// 因此沿下降路径回溯到最近一个还有右兄弟的祖先，再沿最左路径下降到下一个叶节点。
+void cursor_next_leaf(Cursor* cursor) {
+    while (cursor->depth > 0) {
+        uint32_t level = cursor->depth - 1;
+        void* parent = cursor_page(cursor, cursor->path[level]);
+        if (cursor->child_index[level] < *internal_node_num_keys(parent)) {
+            cursor->child_index[level]++;
+            uint32_t page_num = *internal_node_child(parent, cursor->child_index[level]);
+            void* node = cursor_page(cursor, page_num);
+            while (get_node_type(node) == NODE_INTERNAL) {
+                page_num = cursor_push(cursor, page_num, 0);
+                node = cursor_page(cursor, page_num);
+            }
+            cursor->page_num = page_num;
+            cursor->cell_num = 0;
+            return;
+        }
+        cursor->depth--;
+    }
+    cursor->end_of_table = true;
+}
+
+// 叶节点只有向右的 next_leaf，向左移动总是沿下降路径回溯：
+// 找到最近一个左边还有兄弟的祖先，再沿最右路径下降到上一个叶节点
+void cursor_prev_leaf(Cursor* cursor) {
+    while (cursor->depth > 0) {
+        uint32_t level = cursor->depth - 1;
+        if (cursor->child_index[level] > 0) {
+            cursor->child_index[level]--;
+            void* parent = cursor_page(cursor, cursor->path[level]);
+            uint32_t page_num = *internal_node_child(parent, cursor->child_index[level]);
+            void* node = cursor_page(cursor, page_num);
+            while (get_node_type(node) == NODE_INTERNAL) {
+                page_num = cursor_push(cursor, page_num, *internal_node_num_keys(node));
+                node = cursor_page(cursor, page_num);
+            }
+            cursor->page_num = page_num;
+            cursor->cell_num = *leaf_node_num_cells(node) - 1;
+            return;
+        }
+        cursor->depth--;
+    }
+    cursor->end_of_table = true;
+}
+
+void cursor_retreat(Cursor* cursor) {
+    if (cursor->cell_num > 0) {
+        cursor->cell_num--;
+        return;
+    }
+    cursor_prev_leaf(cursor);
+}
+
+// 每当我们想将光标移过叶节点的末尾时，
+// 都可以检查叶节点是否有同级节点
+void cursor_advance(Cursor* cursor) {
+    uint32_t page_num = cursor->page_num;
+    void* node = cursor_page(cursor, page_num);
+    cursor->cell_num += 1;
+    if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
+        if (cursor->table->flags & META_FLAG_COW) {
+            cursor_next_leaf(cursor);
+            return;
+        }
+        /* Advance to next leaf node */
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            /* This was rightmost leaf */
+            cursor->end_of_table = true;
+        } else {
+            cursor->page_num = next_page_num;
+            cursor->cell_num = 0;
+        }
+    }
+}
+
+// 游标所在叶节点即将增加 num_rows 行（可以为负）：路径上每层走向的子树行数先加上。
+// 随后若发生分裂，分裂出的两半在父节点中按实际行数重新登记，
+// 因此调用时只能计入马上写入的行，祖先节点的计数才与分裂时的实际行数一致。
+void cursor_add_rows(Cursor* cursor, int32_t num_rows) {
+    for (uint32_t level = 0; level < cursor->depth; level++) {
+        void* node = get_page(cursor->table->pager, cursor->path[level]);
+        *internal_node_child_rows(node, cursor->child_index[level]) += num_rows;
+    }
+}
+
+// 写入前把整条下降路径变为可写。
+// 影子分页模式下自顶向下把路径上的页复制到新页，并让父节点指向新副本，根页号随之改变。
+void cursor_touch_path(Cursor* cursor) {
+    Table* table = cursor->table;
+    for (uint32_t level = 0; level <= cursor->depth; level++) {
+        uint32_t page_num = level < cursor->depth ? cursor->path[level] : cursor->page_num;
+        uint32_t new_page_num = table_touch_page(table, page_num);
+        if (level == 0) {
+            table->root_page_num = new_page_num;
+        } else {
+            void* parent = get_page(table->pager, cursor->path[level - 1]);
+            *internal_node_child(parent, cursor->child_index[level - 1]) = new_page_num;
+        }
+        if (level < cursor->depth) {
+            cursor->path[level] = new_page_num;
+        } else {
+            cursor->page_num = new_page_num;
+        }
+    }
+}
+
+/* 处理根节点的分裂。
+ * 分配一个新页作为根，分裂出的两半分别成为左右子节点。
+ * 根页号随之改变，提交（或关闭）时写入元数据页。
+*/
+void create_new_root(Table* table, uint32_t left_child_page_num, uint32_t left_child_max_key,
+                     uint32_t right_child_page_num) {
+    uint32_t root_page_num = table_allocate_page(table);
+    void* root = get_page(table->pager, root_page_num);
+    void* left_child = get_page(table->pager, left_child_page_num);
+    set_node_root(left_child, false);
+
+    /* Root node is a new internal node with one key and two children */
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    *internal_node_num_keys(root) = 1;
+    *internal_node_cell(root, 0) = left_child_page_num;
+    *internal_node_key(root, 0) = left_child_max_key;
+    *internal_node_right_child(root) = right_child_page_num;
+    *internal_node_child_rows(root, 0) = node_num_rows(left_child);
+    *internal_node_child_rows(root, 1) = node_num_rows(get_page(table->pager, right_child_page_num));
+    table->root_page_num = root_page_num;
+}
+
+void internal_node_split_and_insert(Cursor* cursor, uint32_t level, uint32_t left_child_max_key,
+                                    uint32_t right_child_page_num);
+
+/* 第 level 层父节点中下标为 child_index[level] 的子节点分裂成了两半：
+ * 左半留在原页，最大键变为 left_child_max_key；右半在 right_child_page_num。
+ * 在父节点中为右半登记一个新单元格。
+*/
+void internal_node_insert(Cursor* cursor, uint32_t level, uint32_t left_child_max_key,
+                          uint32_t right_child_page_num) {
+    void* parent = get_page(cursor->table->pager, cursor->path[level]);
+    uint32_t index = cursor->child_index[level];
+    uint32_t original_num_keys = *internal_node_num_keys(parent);
+
+    if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
+        internal_node_split_and_insert(cursor, level, left_child_max_key, right_child_page_num);
+        return;
+    }
+
+    uint32_t left_child_page_num = *internal_node_child(parent, index);
+    /* Make room for the new cell */
+    for (uint32_t i = original_num_keys; i > index; i--) {
+        void* destination = internal_node_cell(parent, i);
+        void* source = internal_node_cell(parent, i - 1);
+        memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+    }
+    *internal_node_num_keys(parent) = original_num_keys + 1;
+    *internal_node_cell(parent, index) = left_child_page_num;
+    *internal_node_key(parent, index) = left_child_max_key;
+    if (index == original_num_keys) {
+        /* Replace right child */
+        *internal_node_right_child(parent) = right_child_page_num;
+    } else {
+        *internal_node_cell(parent, index + 1) = right_child_page_num;
+    }
+    // 分裂出的两半按实际行数登记
+    Pager* pager = cursor->table->pager;
+    *internal_node_child_rows(parent, index) = node_num_rows(get_page(pager, left_child_page_num));
+    *internal_node_child_rows(parent, index + 1) = node_num_rows(get_page(pager, right_child_page_num));
+}
+
+// 内部节点已满：把插入后的全部子节点展开到临时数组，左右各分一半，
+// 左半最大键上移到祖父节点；到达根时创建新根
+void internal_node_split_and_insert(Cursor* cursor, uint32_t level, uint32_t left_child_max_key,
+                                    uint32_t right_child_page_num) {
+    Table* table = cursor->table;
+    uint32_t old_page_num = cursor->path[level];
+    void* old_node = get_page(table->pager, old_page_num);
+    uint32_t index = cursor->child_index[level];
+    uint32_t num_keys = *internal_node_num_keys(old_node);
+
+    uint32_t children[INTERNAL_NODE_MAX_CELLS + 2];
+    uint32_t rows[INTERNAL_NODE_MAX_CELLS + 2];
+    uint32_t keys[INTERNAL_NODE_MAX_CELLS + 1];
+    uint32_t num_children = 0;
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        children[num_children] = *internal_node_child(old_node, i);
+        rows[num_children] = *internal_node_child_rows(old_node, i);
+        if (i == index) {
+            keys[num_children] = left_child_max_key;
+            rows[num_children] = node_num_rows(get_page(table->pager, children[num_children]));
+            num_children++;
+            children[num_children] = right_child_page_num;
+            rows[num_children] = node_num_rows(get_page(table->pager, right_child_page_num));
+        }
+        if (i < num_keys) {
+            keys[num_children] = *internal_node_key(old_node, i);
+        }
+        num_children++;
+    }
+
+    // 原有子节点先对半分，新分裂出的子节点按所在位置归入左半或右半
+    uint32_t left_count = INTERNAL_NODE_MAX_CELLS / 2 + 1;
+    if (index + 1 < left_count) {
+        left_count++;
+    }
+    uint32_t right_count = num_children - left_count;
+
+    uint32_t new_page_num = table_allocate_page(table);
+    void* new_node = get_page(table->pager, new_page_num);
+    initialize_internal_node(new_node);
+
+    *internal_node_num_keys(old_node) = left_count - 1;
+    for (uint32_t i = 0; i < left_count - 1; i++) {
+        *internal_node_cell(old_node, i) = children[i];
+        *internal_node_key(old_node, i) = keys[i];
+        *internal_node_child_rows(old_node, i) = rows[i];
+    }
+    *internal_node_right_child(old_node) = children[left_count - 1];
+    *internal_node_child_rows(old_node, left_count - 1) = rows[left_count - 1];
+
+    *internal_node_num_keys(new_node) = right_count - 1;
+    for (uint32_t i = 0; i < right_count - 1; i++) {
+        *internal_node_cell(new_node, i) = children[left_count + i];
+        *internal_node_key(new_node, i) = keys[left_count + i];
+        *internal_node_child_rows(new_node, i) = rows[left_count + i];
+    }
+    *internal_node_right_child(new_node) = children[num_children - 1];
+    *internal_node_child_rows(new_node, right_count - 1) = rows[num_children - 1];
+
+    uint32_t old_max_key = keys[left_count - 1];
+    if (level == 0) {
+        create_new_root(table, old_page_num, old_max_key, new_page_num);
+    } else {
+        internal_node_insert(cursor, level - 1, old_max_key, new_page_num);
+    }
+}
+
+// 分裂操作：分配一个新的叶节点，并将较大的一半移动到新节点中。
+void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
+    Table* table = cursor->table;
+    uint32_t row_size = table_row_size(table);
+    uint32_t max_cells = leaf_node_max_cells(row_size);
+    // 分裂时，右边比左边相等或者少一个
+    uint32_t right_split_count = (max_cells + 1) / 2;
+    uint32_t left_split_count = (max_cells + 1) - right_split_count;
+    void* old_node = get_page(table->pager, cursor->page_num);
+    uint32_t new_page_num = table_allocate_page(table);
+    void* new_node = get_page(table->pager, new_page_num);
+    initialize_leaf_node(new_node);
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+    for (int32_t i = max_cells; i >= 0; i--) {
+        void* destination_node;
+        if ((uint32_t)i >= left_split_count) {
+            destination_node = new_node;
+        } else {
+            destination_node = old_node;
+        }
+        uint32_t index_within_node = i % left_split_count;
+        void* destination = leaf_node_cell(destination_node, index_within_node, row_size);
+
+        if ((uint32_t)i == cursor->cell_num) {
+            serialize_row(value,leaf_node_value(destination_node, index_within_node, row_size), row_size);
+            *leaf_node_key(destination_node, index_within_node, row_size) = key;
+        } else if ((uint32_t)i > cursor->cell_num) {
+            memcpy(destination, leaf_node_cell(old_node, i - 1, row_size), leaf_node_cell_size(row_size));
+        } else {
+            memcpy(destination, leaf_node_cell(old_node, i, row_size), leaf_node_cell_size(row_size));
+        }
+    }
+    *(leaf_node_num_cells(old_node)) = left_split_count;
+    *(leaf_node_num_cells(new_node)) = right_split_count;
+
+    uint32_t left_max_key = *leaf_node_key(old_node, left_split_count - 1, row_size);
+    if (cursor->depth == 0) {
+        create_new_root(table, cursor->page_num, left_max_key, new_page_num);
+    } else {
+        internal_node_insert(cursor, cursor->depth - 1, left_max_key, new_page_num);
+    }
+}
+
+void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
+    void* node = get_page(cursor->table->pager, cursor->page_num);
+    uint32_t row_size = table_row_size(cursor->table);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells >= leaf_node_max_cells(row_size)) {
+        leaf_node_split_and_insert(cursor, key, value);
+        return;
+    }
+    // 单元格向右移动一个空格，为新单元格腾出空间
+    if(cursor->cell_num < num_cells) {
+        for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
+            memcpy(leaf_node_cell(node, i, row_size), leaf_node_cell(node, i - 1, row_size),
+                   leaf_node_cell_size(row_size));
+        }
+    }
+    *(leaf_node_num_cells(node)) += 1;
+    *(leaf_node_key(node, cursor->cell_num, row_size)) = key;
+    serialize_row(value, leaf_node_value(node, cursor->cell_num, row_size), row_size);
+}
+
+// 字符串主键的根分裂：新根只有一个分隔键和两个子节点
+void string_create_new_root(Table* table, uint32_t left_child_page_num, Key* separator,
+                            uint32_t right_child_page_num) {
+    uint32_t root_page_num = table_allocate_page(table);
+    void* root = get_page(table->pager, root_page_num);
+    void* left_child = get_page(table->pager, left_child_page_num);
+    set_node_root(left_child, false);
+
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    uint32_t children[2] = {left_child_page_num, right_child_page_num};
+    uint32_t rows[2] = {node_num_rows(left_child), node_num_rows(get_page(table->pager, right_child_page_num))};
+    string_internal_encode(root, children, rows, separator, 1);
+    table->root_page_num = root_page_num;
+}
+
+// 在第 level 层父节点中，下标为 child_index[level] 的子节点之后插入分隔键和右半子节点。
+// 放不下时按键数对半分裂，中间的分隔键上移。
+void string_internal_node_insert(Cursor* cursor, uint32_t level, Key* separator,
+                                 uint32_t right_child_page_num) {
+    Table* table = cursor->table;
+    uint32_t page_num = cursor->path[level];
+    void* node = get_page(table->pager, page_num);
+    uint32_t index = cursor->child_index[level];
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    uint32_t children[STRING_INTERNAL_MAX_KEYS + 2];
+    uint32_t rows[STRING_INTERNAL_MAX_KEYS + 2];
+    Key keys[STRING_INTERNAL_MAX_KEYS + 1];
+    for (uint32_t i = 0, j = 0; i <= num_keys; i++, j++) {
+        children[j] = *internal_node_child(node, i);
+        rows[j] = *internal_node_child_rows(node, i);
+        if (i == index) {
+            keys[j] = *separator;
+            rows[j] = node_num_rows(get_page(table->pager, children[j]));
+            j++;
+            children[j] = right_child_page_num;
+            rows[j] = node_num_rows(get_page(table->pager, right_child_page_num));
+        }
+        if (i < num_keys) {
+            string_internal_key(node, i, &keys[j]);
+        }
+    }
+    num_keys++;
+
+    if (string_internal_encoded_size(keys, num_keys) <= PAGE_SIZE) {
+        string_internal_encode(node, children, rows, keys, num_keys);
+        return;
+    }
+
+    uint32_t left_num_keys = num_keys / 2;
+    uint32_t new_page_num = table_allocate_page(table);
+    void* new_node = get_page(table->pager, new_page_num);
+    initialize_internal_node(new_node);
+    string_internal_encode(node, children, rows, keys, left_num_keys);
+    string_internal_encode(new_node, children + left_num_keys + 1, rows + left_num_keys + 1,
+                           keys + left_num_keys + 1, num_keys - left_num_keys - 1);
+
+    Key promoted = keys[left_num_keys];
+    if (level == 0) {
+        string_create_new_root(table, page_num, &promoted, new_page_num);
+    } else {
+        string_internal_node_insert(cursor, level - 1, &promoted, new_page_num);
+    }
+}
+
+// 解码整页、插入新单元格后重新编码。放不下时按字节数对半分裂，
+// 右半最小键截成能与左半最大键区分的最短前缀，作为分隔键插入父节点。
+void string_leaf_node_insert(Cursor* cursor, Key* key, Row* value) {
+    Table* table = cursor->table;
+    void* node = get_page(table->pager, cursor->page_num);
+    uint8_t original[PAGE_SIZE];
+    memcpy(original, node, PAGE_SIZE);
+    uint32_t row_size = table_row_size(table);
+    uint8_t row[MAX_ROW_SIZE];
+    serialize_row(value, row, row_size);
+
+    uint32_t num_cells = *leaf_node_num_cells(original);
+    StringLeafEntry entries[string_leaf_max_cells(row_size) + 1];
+    for (uint32_t i = 0, j = 0; i <= num_cells; i++, j++) {
+        if (i == cursor->cell_num) {
+            entries[j].key = *key;
+            entries[j].value = row;
+            j++;
+        }
+        if (i < num_cells) {
+            string_leaf_key(original, i, &entries[j].key);
+            entries[j].value = string_leaf_value(original, i);
+        }
+    }
+    num_cells++;
+
+    uint32_t total_size = string_leaf_encoded_size(entries, num_cells, row_size);
+    if (total_size <= PAGE_SIZE) {
+        string_leaf_encode(node, entries, num_cells, row_size);
+        return;
+    }
+
+    uint32_t left_count = 1;
+    while (left_count < num_cells - 1 &&
+           string_leaf_encoded_size(entries, left_count, row_size) < total_size / 2) {
+        left_count++;
+    }
+    uint32_t new_page_num = table_allocate_page(table);
+    void* new_node = get_page(table->pager, new_page_num);
+    initialize_leaf_node(new_node);
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(node);
+    *leaf_node_next_leaf(node) = new_page_num;
+    string_leaf_encode(node, entries, left_count, row_size);
+    string_leaf_encode(new_node, entries + left_count, num_cells - left_count, row_size);
+
+    Key separator = entries[left_count].key;
+    separator.length = common_prefix_length(&entries[left_count - 1].key, &separator) + 1;
+    if (cursor->depth == 0) {
+        string_create_new_root(table, cursor->page_num, &separator, new_page_num);
+    } else {
+        string_internal_node_insert(cursor, cursor->depth - 1, &separator, new_page_num);
+    }
+}
+
+// 写者按主键下降到叶节点
+Cursor* tree_find_key(Table* table, Key* key) {
+    return tree_seek(table, NULL, table->root_page_num, key);
+}
+
+bool tree_contains(Table* table, Key* key) {
+    Cursor* cursor = tree_find_key(table, key);
+    void* node = get_page(table->pager, cursor->page_num);
+    bool found = false;
+    if (cursor->cell_num < *leaf_node_num_cells(node)) {
+        Key key_at_index;
+        key_from_value(table->flags & META_FLAG_STRING_KEY, cursor_value(cursor), &key_at_index);
+        found = compare_keys(&key_at_index, key) == 0;
+    }
+    free(cursor);
+    return found;
+}
+
+// 游标所在叶节点的键上界：沿路径向上找第一个不是最右子节点的祖先，它的分隔键就是上界。
+// 整数主键不大于上界的键属于该叶节点，字符串主键要小于上界。一路都是最右子节点时没有上界。
+bool cursor_leaf_upper_bound(Cursor* cursor, Key* bound) {
+    for (uint32_t level = cursor->depth; level > 0; level--) {
+        void* parent = get_page(cursor->table->pager, cursor->path[level - 1]);
+        uint32_t index = cursor->child_index[level - 1];
+        if (index < *internal_node_num_keys(parent)) {
+            if (cursor->table->flags & META_FLAG_STRING_KEY) {
+                string_internal_key(parent, index, bound);
+            } else {
+                key_from_id(*internal_node_key(parent, index), bound);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool leaf_entries_fit(Table* table, StringLeafEntry* entries, uint32_t num_cells) {
+    uint32_t row_size = table_row_size(table);
+    if (table->flags & META_FLAG_STRING_KEY) {
+        return num_cells <= string_leaf_max_cells(row_size) &&
+               string_leaf_encoded_size(entries, num_cells, row_size) <= PAGE_SIZE;
+    }
+    return num_cells <= leaf_node_max_cells(row_size);
+}
+
+void leaf_write_entries(Table* table, void* node, StringLeafEntry* entries, uint32_t num_cells) {
+    uint32_t row_size = table_row_size(table);
+    if (table->flags & META_FLAG_STRING_KEY) {
+        string_leaf_encode(node, entries, num_cells, row_size);
+        return;
+    }
+    *leaf_node_num_cells(node) = num_cells;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        *leaf_node_key(node, i, row_size) = key_as_id(&entries[i].key);
+        memcpy(leaf_node_value(node, i, row_size), entries[i].value, row_size);
+    }
+}
+
+// 把剩余的 remaining 个单元格尽量均分：找最少的份数，使每份都放得进一个叶节点
+uint32_t leaf_chunk_size(Table* table, StringLeafEntry* entries, uint32_t remaining) {
+    for (uint32_t parts = 1;; parts++) {
+        uint32_t count = (remaining + parts - 1) / parts;
+        if (leaf_entries_fit(table, entries, count)) {
+            return count;
+        }
+    }
+}
+
+// 取出内存表中落在同一个叶节点的全部行，与叶节点原有的单元格归并后一次写回。
+// 放不下时写成若干个相邻的叶节点，新叶节点逐个登记到父节点。
+// 页数不够时不做任何修改，返回 false。
+bool memtable_flush_leaf(Table* table) {
+    Memtable* memtable = table->memtable;
+    bool string_key = table->flags & META_FLAG_STRING_KEY;
+    uint32_t row_size = table_row_size(table);
+    MemtableNode* first = memtable_first(memtable);
+    Cursor* cursor = tree_find_key(table, &first->key);
+    Key bound;
+    bool bounded = cursor_leaf_upper_bound(cursor, &bound);
+
+    uint8_t original[PAGE_SIZE];
+    memcpy(original, get_page(table->pager, cursor->page_num), PAGE_SIZE);
+    uint32_t num_cells = *leaf_node_num_cells(original);
+    StringLeafEntry* entries = malloc((num_cells + memtable->num_rows) * sizeof(StringLeafEntry));
+    uint32_t num_entries = 0;
+    uint32_t num_taken = 0;
+    MemtableNode* row = first;
+    for (uint32_t i = 0; i < num_cells || row != NULL;) {
+        if (row != NULL && bounded) {
+            int result = compare_keys(&row->key, &bound);
+            if (string_key ? result >= 0 : result > 0) {
+                row = NULL;
+            }
+        }
+        StringLeafEntry cell;
+        if (i < num_cells) {
+            if (string_key) {
+                string_leaf_key(original, i, &cell.key);
+                cell.value = string_leaf_value(original, i);
+            } else {
+                key_from_id(*leaf_node_key(original, i, row_size), &cell.key);
+                cell.value = leaf_node_value(original, i, row_size);
+            }
+        }
+        if (row != NULL && (i == num_cells || compare_keys(&row->key, &cell.key) < 0)) {
+            entries[num_entries].key = row->key;
+            entries[num_entries].value = row->value;
+            row = row->next[0];
+            num_taken++;
+        } else if (i < num_cells) {
+            entries[num_entries] = cell;
+            i++;
+        } else {
+            break;
+        }
+        num_entries++;
+    }
+
+    uint32_t num_leaves = 0;
+    for (uint32_t start = 0; start < num_entries; num_leaves++) {
+        start += leaf_chunk_size(table, entries + start, num_entries - start);
+    }
+    // 最坏情况下每个新叶节点都让分裂一路传到根；影子分页还要先复制整条路径
+    uint32_t pages_needed = (num_leaves - 1) * (cursor->depth + 2);
+    if (table->flags & META_FLAG_COW) {
+        pages_needed += cursor->depth + 1;
+    }
+    if (table_num_available_pages(table) < pages_needed) {
+        free(entries);
+        free(cursor);
+        return false;
+    }
+
+    cursor_touch_path(cursor);
+    uint32_t count = leaf_chunk_size(table, entries, num_entries);
+    cursor_add_rows(cursor, (int32_t)count - (int32_t)num_cells);
+    leaf_write_entries(table, get_page(table->pager, cursor->page_num), entries, count);
+    for (uint32_t start = count; start < num_entries; start += count) {
+        count = leaf_chunk_size(table, entries + start, num_entries - start);
+        void* previous = get_page(table->pager, cursor->page_num);
+        uint32_t new_page_num = table_allocate_page(table);
+        void* new_node = get_page(table->pager, new_page_num);
+        initialize_leaf_node(new_node);
+        *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(previous);
+        *leaf_node_next_leaf(previous) = new_page_num;
+        leaf_write_entries(table, new_node, entries + start, count);
+        cursor_add_rows(cursor, count);
+
+        if (string_key) {
+            Key separator = entries[start].key;
+            separator.length = common_prefix_length(&entries[start - 1].key, &separator) + 1;
+            if (cursor->depth == 0) {
+                string_create_new_root(table, cursor->page_num, &separator, new_page_num);
+            } else {
+                string_internal_node_insert(cursor, cursor->depth - 1, &separator, new_page_num);
+            }
+        } else {
+            uint32_t left_max_key = key_as_id(&entries[start - 1].key);
+            if (cursor->depth == 0) {
+                create_new_root(table, cursor->page_num, left_max_key, new_page_num);
+            } else {
+                internal_node_insert(cursor, cursor->depth - 1, left_max_key, new_page_num);
+            }
+        }
+        // 父节点可能刚分裂过，重新下降得到新叶节点的路径
+        free(cursor);
+        cursor = tree_find_key(table, &entries[start].key);
+        cursor_touch_path(cursor);
+    }
+
+    free(entries);
+    free(cursor);
+    memtable_remove_first(memtable, num_taken);
+    return true;
+}
+
+// 把内存表按键序整批合并进树，每个叶节点在一次合并中只改写一次。
+// 影子分页模式下整批通常作为一个事务提交。返回内存表是否已清空。
+bool table_flush_memtable(Table* table) {
+    Memtable* memtable = table->memtable;
+    if (memtable == NULL || memtable->num_rows == 0) {
+        return true;
+    }
+    if (table->flags & META_FLAG_COW) {
+        table_reclaim_pages(table);
+    }
+    while (memtable->num_rows > 0) {
+        if (memtable_flush_leaf(table)) {
+            continue;
+        }
+        // 影子分页下本批替换下来的旧页要等提交后才能复用，页数不够时先提交一次再试
+        if (!(table->flags & META_FLAG_COW) || table->pager->num_dirty_pages == 0) {
+            break;
+        }
+        table_commit(table);
+    }
+    table_commit(table);
+    return memtable->num_rows == 0;
+}
+
+
+// SQL compiler
+// insert 后依次是各列的值，按表结构编码进行数据
+PrepareResult prepare_insert(InputBuffer* input_buffer, Table* table, Statement* statement) {
+    statement->type = STATEMENT_INSERT;
+    Schema* schema = &table->schema;
+
+    strtok(input_buffer->buffer, " ");
+    char* values[SCHEMA_MAX_COLUMNS];
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        values[i] = strtok(NULL, " ");
+        if (values[i] == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+
+    memset(statement->row_to_insert.data, 0, schema_row_size(schema));
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        ColumnDef* column = &schema->columns[i];
+        PrepareResult result = TYPE_CODECS[column->type].parse(column, values[i], strlen(values[i]),
+                                                               statement->row_to_insert.data + column->offset);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (i == 0 && (int32_t)row_id(&statement->row_to_insert) < 0) {
+            return PREPARE_NEGATIVE_ID;
+        }
+    }
+    return PREPARE_SUCCESS;
+}
+
+// 跳过空格后读一个标识符（字母、数字和下划线），为空或过长时返回 false
+bool parse_identifier(char** cursor, char* name) {
+    char* start = *cursor;
+    while (*start == ' ') {
+        start++;
+    }
+    uint32_t length = 0;
+    while (isalnum((unsigned char)start[length]) || start[length] == '_') {
+        length++;
+    }
+    if (length == 0 || length >= SCHEMA_NAME_SIZE) {
+        return false;
+    }
+    memcpy(name, start, length);
+    name[length] = '\0';
+    *cursor = start + length;
+    return true;
+}
+
+// 跳过空格后匹配一个字符
+bool parse_symbol(char** cursor, char symbol) {
+    char* start = *cursor;
+    while (*start == ' ') {
+        start++;
+    }
+    if (*start != symbol) {
+        return false;
+    }
+    *cursor = start + 1;
+    return true;
+}
+
+// create table <表名> (<列> <类型>, ...)，类型是 int、float、char(n) 或 varchar(n)。
+// 各列按顺序紧接着定长存放，总宽不超过 MAX_ROW_SIZE
+PrepareResult prepare_create(InputBuffer* input_buffer, Table* table, Statement* statement) {
+    statement->type = STATEMENT_CREATE;
+    Schema* schema = &statement->schema;
+    memset(schema, 0, sizeof(Schema));
+
+    char* cursor = input_buffer->buffer;
+    char word[SCHEMA_NAME_SIZE];
+    if (!parse_identifier(&cursor, word) || strcmp(word, "create") != 0 || !parse_identifier(&cursor, word) ||
+        strcmp(word, "table") != 0 || !parse_identifier(&cursor, schema->name) || !parse_symbol(&cursor, '(')) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    do {
+        char name[SCHEMA_NAME_SIZE];
+        if (!parse_identifier(&cursor, name) || !parse_identifier(&cursor, word)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        ColumnType type = 0;
+        while (type < sizeof(TYPE_CODECS) / sizeof(TypeCodec) && strcmp(TYPE_CODECS[type].name, word) != 0) {
+            type++;
+        }
+        if (type == sizeof(TYPE_CODECS) / sizeof(TypeCodec)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        long length = 0;
+        if (TYPE_CODECS[type].sized) {
+            if (!parse_symbol(&cursor, '(')) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            char* end;
+            length = strtol(cursor, &end, 10);
+            if (end == cursor || !parse_symbol(&end, ')')) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            cursor = end;
+            if (length <= 0 || length > MAX_ROW_SIZE) {
+                return PREPARE_INVALID_SCHEMA;
+            }
+        }
+        if (parse_column(schema, name) != COLUMN_NONE || !schema_add_column(schema, name, type, length)) {
+            return PREPARE_INVALID_SCHEMA;
+        }
+    } while (parse_symbol(&cursor, ','));
+    if (!parse_symbol(&cursor, ')')) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    while (*cursor == ' ') {
+        cursor++;
+    }
+    if (*cursor != '\0') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    // 第一列是整数主键；字符串主键模式下第二列是主键，要能放进键里
+    if (schema->columns[0].type != TYPE_INT) {
+        return PREPARE_INVALID_SCHEMA;
+    }
+    if ((table->flags & META_FLAG_STRING_KEY) &&
+        (schema->num_columns < 2 || schema->columns[1].type != TYPE_VARCHAR ||
+         schema->columns[1].length > COLUMN_USERNAME_SIZE)) {
+        return PREPARE_INVALID_SCHEMA;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// limit 和 offset 的参数：非负整数
+bool parse_count(const char* string, uint32_t* count) {
+    if (string == NULL) {
+        return false;
+    }
+    char* end;
+    long value = strtol(string, &end, 10);
+    if (*end != '\0' || value < 0) {
+        return false;
+    }
+    *count = value;
+    return true;
+}
+
+// 分区下界和 .split 的参数：正整数，整个字符串都必须是数字。主键是 int 列，不超过 INT32_MAX
+bool parse_id(const char* string, uint32_t* id) {
+    char* end;
+    long value = strtol(string, &end, 10);
+    if (end == string || *end != '\0' || value <= 0 || value > INT32_MAX) {
+        return false;
+    }
+    *id = value;
+    return true;
+}
+
+// 解析条件中的一个值并按列的类型编码进 field，字符串值可以用单引号括起来；
+// prefix 时去掉结尾的 %，只编码前缀，前缀长度写入 *length
+PrepareResult prepare_filter_value(Column column, ColumnDef* def, char* value, bool prefix, void* field,
+                                   uint32_t* length) {
+    uint32_t value_length = strlen(value);
+    if (value_length >= 2 && value[0] == '\'' && value[value_length - 1] == '\'') {
+        value++;
+        value_length -= 2;
+    }
+    if (prefix) {
+        // 只支持字符串列的前缀匹配：% 只能出现在末尾
+        if (def->type == TYPE_INT || def->type == TYPE_FLOAT || value_length == 0 ||
+            value[value_length - 1] != '%' || memchr(value, '%', value_length - 1) != NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        value_length--;
+    }
+    PrepareResult result = TYPE_CODECS[def->type].parse(def, value, value_length, field);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    // 整数主键都是非负的
+    int32_t id;
+    memcpy(&id, field, sizeof(id));
+    if (column == COLUMN_ID && id < 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *length = value_length;
+    return PREPARE_SUCCESS;
+}
+
+// in 的值列表 (<值>, <值>, ...)，逗号前后可以有空格，列表可以跨越多个记号。
+// 值按主键的编码放进 Key，只支持 int 列和不超过键长的字符串列
+PrepareResult prepare_filter_list(Filter* filter, char* token) {
+    ColumnDef* def = &filter->def;
+    bool string = def->type == TYPE_CHAR || def->type == TYPE_VARCHAR;
+    if ((def->type != TYPE_INT && !(string && def->length <= COLUMN_USERNAME_SIZE)) || token[0] != '(') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    token++;
+    filter->num_keys = 0;
+    uint32_t capacity = 0;
+    bool closed = false;
+    while (!closed) {
+        if (token == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        uint32_t length = strlen(token);
+        if (length > 0 && token[length - 1] == ')') {
+            token[length - 1] = '\0';
+            closed = true;
+        }
+        char* save;
+        for (char* value = strtok_r(token, ",", &save); value != NULL; value = strtok_r(NULL, ",", &save)) {
+            if (filter->num_keys >= MAX_IN_KEYS) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            if (filter->num_keys == capacity) {
+                capacity = capacity == 0 ? 16 : capacity * 2;
+                filter->keys = realloc(filter->keys, capacity * sizeof(Key));
+            }
+            Key* key = &filter->keys[filter->num_keys++];
+            uint8_t field[MAX_ROW_SIZE];
+            PrepareResult result = prepare_filter_value(filter->column, def, value, false, field, &key->length);
+            if (result != PREPARE_SUCCESS) {
+                return result;
+            }
+            if (string) {
+                memcpy(key->data, field, key->length);
+            } else {
+                uint32_t id;
+                memcpy(&id, field, sizeof(id));
+                key_from_id(id, key);
+            }
+        }
+        if (!closed) {
+            token = strtok(NULL, " ");
+        }
+    }
+    return filter->num_keys > 0 ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+// where <列> = <值>、where <列> like '<前缀>%'、where <列> between <下界> and <上界>
+// 或 where <列> in (<值>, ...)
+PrepareResult prepare_filter(Schema* schema, Filter* filter) {
+    char* column = strtok(NULL, " ");
+    char* operator = strtok(NULL, " ");
+    char* value = strtok(NULL, " ");
+    if (column == NULL || operator == NULL || value == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    filter->column = parse_column(schema, column);
+    if (filter->column == COLUMN_NONE) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    filter->def = schema->columns[filter->column - 1];
+    if (strcmp(operator, "like") == 0) {
+        filter->type = FILTER_PREFIX;
+    } else if (strcmp(operator, "between") == 0) {
+        filter->type = FILTER_BETWEEN;
+    } else if (strcmp(operator, "in") == 0) {
+        filter->type = FILTER_IN;
+        return prepare_filter_list(filter, value);
+    } else if (strcmp(operator, "=") != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    PrepareResult result = prepare_filter_value(filter->column, &filter->def, value, filter->type == FILTER_PREFIX,
+                                                filter->value, &filter->length);
+    if (result != PREPARE_SUCCESS || filter->type != FILTER_BETWEEN) {
+        return result;
+    }
+    char* and = strtok(NULL, " ");
+    char* high = strtok(NULL, " ");
+    if (and == NULL || strcmp(and, "and") != 0 || high == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    uint32_t high_length;
+    return prepare_filter_value(filter->column, &filter->def, high, false, filter->high_value, &high_length);
+}
+
+// select [<列>, ... | count(*)] [where ...] [order by <列> [asc|desc]] [limit <n>] [offset <n>]
+PrepareResult prepare_select(InputBuffer* input_buffer, Table* table, Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    statement->num_columns = 0;
+    statement->count = false;
+    statement->filter.column = COLUMN_NONE;
+    statement->filter.type = FILTER_EQUAL;
+    statement->order_by = COLUMN_NONE;
+    statement->descending = false;
+    statement->limit = UINT32_MAX;
+    statement->offset = 0;
+
+    char* keyword = strtok(input_buffer->buffer, " ");
+    if (strcmp(keyword, "select") != 0) {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+    char* token = strtok(NULL, " ");
+    // 列清单，逗号前后可以有空格；* 表示全部列
+    if (token != NULL && (strcmp(token, "*") == 0 || strcmp(token, "count(*)") == 0)) {
+        statement->count = strcmp(token, "count(*)") == 0;
+        token = strtok(NULL, " ");
+    } else {
+        while (token != NULL && strcmp(token, "where") != 0 && strcmp(token, "order") != 0 &&
+               strcmp(token, "limit") != 0 && strcmp(token, "offset") != 0) {
+            char* save;
+            for (char* name = strtok_r(token, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+                Column column = parse_column(&table->schema, name);
+                if (column == COLUMN_NONE || statement->num_columns >= SCHEMA_MAX_COLUMNS) {
+                    return PREPARE_SYNTAX_ERROR;
+                }
+                statement->columns[statement->num_columns++] = column;
+            }
+            token = strtok(NULL, " ");
+        }
+    }
+    if (token != NULL && strcmp(token, "where") == 0) {
+        PrepareResult result = prepare_filter(&table->schema, &statement->filter);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        token = strtok(NULL, " ");
+    }
+    if (token != NULL && strcmp(token, "order") == 0) {
+        char* by = strtok(NULL, " ");
+        char* column = strtok(NULL, " ");
+        if (by == NULL || strcmp(by, "by") != 0 || column == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->order_by = parse_column(&table->schema, column);
+        if (statement->order_by == COLUMN_NONE) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+        if (token != NULL && (strcmp(token, "asc") == 0 || strcmp(token, "desc") == 0)) {
+            statement->descending = strcmp(token, "desc") == 0;
+            token = strtok(NULL, " ");
+        }
+    }
+    if (token != NULL && strcmp(token, "limit") == 0) {
+        if (!parse_count(strtok(NULL, " "), &statement->limit)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+    }
+    if (token != NULL && strcmp(token, "offset") == 0) {
+        if (!parse_count(strtok(NULL, " "), &statement->offset)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+    }
+    if (token != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// 释放语句解析时分配的内存
+void statement_free(Statement* statement) {
+    free(statement->filter.keys);
+    statement->filter.keys = NULL;
+}
+
+// 解析失败时已分配的内存随即释放，成功时由调用者执行后调用 statement_free
+PrepareResult prepare_statement(InputBuffer* input_buffer, Table* table,
+                                Statement* statement) {
+    statement->filter.keys = NULL;
+    PrepareResult result = PREPARE_UNRECOGNIZED_STATEMENT;
+    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
+        result = prepare_insert(input_buffer, table, statement);
+    } else if (strncmp(input_buffer->buffer, "select", 6) == 0) {
+        result = prepare_select(input_buffer, table, statement);
+    } else if (strncmp(input_buffer->buffer, "create", 6) == 0) {
+        result = prepare_create(input_buffer, table, statement);
+    }
+    if (result != PREPARE_SUCCESS) {
+        statement_free(statement);
+    }
+    return result;
+}
+
+// num_rows 行按 100% 填充率整体重写（见 table_rewrite）最多用到的数据页数
+uint32_t table_packed_pages(Table* table, uint32_t num_rows) {
+    uint32_t rows_per_leaf;
+    uint32_t children_per_node;
+    uint32_t row_size = table_row_size(table);
+    if (table->flags & META_FLAG_STRING_KEY) {
+        // 最坏情况：键之间没有公共前缀，分隔键都取满长
+        rows_per_leaf = (PAGE_SIZE - STRING_LEAF_SLOTS_OFFSET) /
+                        (STRING_LEAF_SLOT_SIZE + sizeof(uint8_t) + COLUMN_USERNAME_SIZE + row_size);
+        children_per_node = (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / (INTERNAL_NODE_CELL_SIZE + COLUMN_USERNAME_SIZE);
+    } else {
+        rows_per_leaf = leaf_node_max_cells(row_size);
+        children_per_node = INTERNAL_NODE_MAX_CELLS + 1;
+    }
+    // 分组时最后一组不留单个子节点，按每组少一个子节点估计
+    uint32_t num_nodes = num_rows == 0 ? 1 : (num_rows + rows_per_leaf - 1) / rows_per_leaf;
+    uint32_t pages = num_nodes;
+    while (num_nodes > 1) {
+        num_nodes = (num_nodes + children_per_node - 2) / (children_per_node - 1);
+        pages += num_nodes;
+    }
+    return pages;
+}
+
+bool table_merge_memtable(Table* table);
+
+// SQL 执行器
+// 写入模式：新行只进内存表，攒满一批再合并进树。
+// 内存表中的行在合并之前不落盘，进程崩溃时会丢失。
+// 确认写入的行在关闭时一定要写得进去，所以只接受整体紧凑重写也放得下的行。
+ExecuteResult execute_ingest(Statement* statement, Table* table) {
+    Memtable* memtable = table->memtable;
+    // 上次合并因页数不够没有完成
+    if (memtable->num_rows >= MEMTABLE_MAX_ROWS && !table_merge_memtable(table)) {
+        return EXECUTE_TABLE_FULL;
+    }
+    uint32_t row_size = table_row_size(table);
+    uint8_t value[MAX_ROW_SIZE];
+    serialize_row(&statement->row_to_insert, value, row_size);
+    Key key;
+    key_from_value(table->flags & META_FLAG_STRING_KEY, value, &key);
+    if (memtable_contains(memtable, &key) || tree_contains(table, &key)) {
+        return EXECUTE_DUPLICATE_KEY;
+    }
+    uint32_t num_rows = tree_num_rows(table, NULL, table->root_page_num) + memtable->num_rows + 1;
+    if (table_packed_pages(table, num_rows) > TABLE_MAX_PAGES - META_PAGE_COUNT) {
+        return EXECUTE_TABLE_FULL;
+    }
+    memtable_insert(memtable, &key, value, row_size);
+    if (memtable->num_rows >= MEMTABLE_MAX_ROWS) {
+        table_merge_memtable(table);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult partitions_insert(Statement* statement, Table* table);
+
+ExecuteResult execute_insert(Statement* statement, Table* table) {
+    if (table->partitions != NULL) {
+        return partitions_insert(statement, table);
+    }
+    if (table->memtable != NULL) {
+        return execute_ingest(statement, table);
+    }
+    Row* row_to_insert = &(statement->row_to_insert);
+    bool string_key = table->flags & META_FLAG_STRING_KEY;
+    uint32_t key_to_insert = row_id(row_to_insert);
+    Key string_key_to_insert;
+    Cursor* cursor;
+    if (string_key) {
+        key_from_row(row_to_insert, &string_key_to_insert);
+        cursor = string_tree_find(table, NULL, table->root_page_num, &string_key_to_insert);
+    } else {
+        cursor = table_find(table, key_to_insert);
+    }
     void* node = get_page(table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    cursor->end_of_table = (num_cells == 0);
+    uint32_t num_cells = (*leaf_node_num_cells(node));
+    if (cursor->cell_num < num_cells) {
+        bool duplicate;
+        if (string_key) {
+            Key key_at_index;
+            string_leaf_key(node, cursor->cell_num, &key_at_index);
+            duplicate = compare_keys(&key_at_index, &string_key_to_insert) == 0;
+        } else {
+            duplicate = *leaf_node_key(node, cursor->cell_num, table_row_size(table)) == key_to_insert;
+        }
+        if (duplicate) {
+            free(cursor);
+            return EXECUTE_DUPLICATE_KEY;
+        }
+    }
+
+    // 最坏情况下分裂一路传到根并产生新根；影子分页还要先复制整条路径
+    uint32_t pages_needed = cursor->depth + 2;
+    if (table->flags & META_FLAG_COW) {
+        pages_needed += cursor->depth + 1;
+        table_reclaim_pages(table);
+    }
+    if (table_num_available_pages(table) < pages_needed) {
+        free(cursor);
+        return EXECUTE_TABLE_FULL;
+    }
+
+    cursor_touch_path(cursor);
+    cursor_add_rows(cursor, 1);
+    if (string_key) {
+        string_leaf_node_insert(cursor, &string_key_to_insert, row_to_insert);
+    } else {
+        leaf_node_insert(cursor, key_to_insert, row_to_insert);
+    }
+    free(cursor);
+    table_commit(table);
+    return EXECUTE_SUCCESS;
+}
+
+// 原地排序并去重，返回去重后的键数
+uint32_t sort_unique_keys(Key* keys, uint32_t num_keys) {
+    qsort(keys, num_keys, sizeof(Key), compare_key_entries);
+    uint32_t num_unique = 0;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        if (num_unique == 0 || compare_keys(&keys[num_unique - 1], &keys[i]) != 0) {
+            keys[num_unique++] = keys[i];
+        }
+    }
+    return num_unique;
+}
+
+// 批量点查：keys 按主键排序去重后自根向下遍历一次，返回去重后的键数。
+// values[i] 指向 keys[i] 的行数据，不存在时为 NULL；写入模式下也查内存表。
+uint32_t table_multi_get(Table* table, Snapshot* snapshot, uint32_t root_page_num, Key* keys, uint32_t num_keys,
+                         void** values) {
+    uint32_t num_unique = sort_unique_keys(keys, num_keys);
+    Cursor* cursor = new_cursor(table, snapshot);
+    multi_get_node(cursor, root_page_num, keys, num_unique, values);
+    free(cursor);
+    for (uint32_t i = 0; i < num_unique && table->memtable != NULL; i++) {
+        if (values[i] == NULL) {
+            MemtableNode* node = memtable_seek(table->memtable, &keys[i], NULL);
+            if (node != NULL && compare_keys(&node->key, &keys[i]) == 0) {
+                values[i] = node->value;
+            }
+        }
+    }
+    return num_unique;
+}
+
+// 直接在页内的行数据上判断条件，不复制整行
+bool filter_matches(Filter* filter, void* value) {
+    if (filter->column == COLUMN_NONE) {
+        return true;
+    }
+    ColumnDef* def = &filter->def;
+    const TypeCodec* codec = &TYPE_CODECS[def->type];
+    void* field = value + def->offset;
+    switch (filter->type) {
+        case (FILTER_EQUAL):
+            return codec->compare(def, field, filter->value) == 0;
+        case (FILTER_PREFIX):
+            return memcmp(field, filter->value, filter->length) == 0;
+        case (FILTER_BETWEEN):
+            return codec->compare(def, field, filter->value) >= 0 &&
+                   codec->compare(def, field, filter->high_value) <= 0;
+        case (FILTER_IN):
+            break;
+    }
+    if (def->type == TYPE_INT) {
+        uint32_t id;
+        memcpy(&id, field, sizeof(id));
+        for (uint32_t i = 0; i < filter->num_keys; i++) {
+            if (key_as_id(&filter->keys[i]) == id) {
+                return true;
+            }
+        }
+        return false;
+    }
+    for (uint32_t i = 0; i < filter->num_keys; i++) {
+        if (compare_field(field, def->size, (char*)filter->keys[i].data, filter->keys[i].length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 主键条件的下界（high 时为上界）
+void filter_key(Filter* filter, bool high, Key* key) {
+    uint8_t* value = high ? filter->high_value : filter->value;
+    if (filter->column == COLUMN_ID) {
+        uint32_t id;
+        memcpy(&id, value, sizeof(id));
+        key_from_id(id, key);
+        return;
+    }
+    key->length = filter->type == FILTER_PREFIX ? filter->length : strnlen((char*)value, COLUMN_USERNAME_SIZE);
+    memcpy(key->data, value, key->length);
+}
+
+// 主键条件的整数下界（high 时为上界）
+uint32_t filter_id(Filter* filter, bool high) {
+    uint32_t id;
+    memcpy(&id, high && filter->type == FILTER_BETWEEN ? filter->high_value : filter->value, sizeof(id));
+    return id;
+}
+
+// 只输出请求的列，字段直接从页内读出
+void print_columns(void* value, Schema* schema, Column* columns, uint32_t num_columns) {
+    fprintf(output_stream, "(");
+    for (uint32_t i = 0; i < num_columns; i++) {
+        if (i > 0) {
+            fprintf(output_stream, ", ");
+        }
+        ColumnDef* def = &schema->columns[columns[i] - 1];
+        TYPE_CODECS[def->type].print(def, value + def->offset);
+    }
+    fprintf(output_stream, ")\n");
+}
+
+// 查找停在叶节点末尾之后时，移到下一个叶节点的开头
+void cursor_skip_leaf_end(Cursor* cursor) {
+    uint32_t num_cells = *leaf_node_num_cells(cursor_page(cursor, cursor->page_num));
+    if (num_cells == 0) {
+        cursor->end_of_table = true;
+    } else if (cursor->cell_num >= num_cells) {
+        cursor->cell_num = num_cells - 1;
+        cursor_advance(cursor);
+    }
+}
+
+// 一次 select 的执行状态。分区表依次在各分区上执行，跳过的行数和输出的行数跨分区累计
+typedef struct {
+    Column* columns;
+    uint32_t num_columns;
+    uint32_t skip;      // 还要跳过的匹配行数（offset）
+    uint32_t count;     // 已输出的行数，count(*) 时为已计数的行数
+    Key* keys;          // 主键 in 列表中落在当前表里的键，已排序去重
+    uint32_t num_keys;
+} SelectState;
+
+// 选出扫描的起点。条件落在主键上时（等值、区间，或升序扫描字符串主键的前缀），
+// 从第一个可能匹配的位置开始，遇到第一个不匹配的行就结束（*key_range）；其余条件逐行在页内判断。
+// 没有条件时按子树行数直接跳过 state->skip 行。写入模式下 *pending 是内存表中对应的起点。
+Cursor* select_start(Statement* statement, Table* table, Snapshot* snapshot, uint32_t root_page_num,
+                     bool descending, SelectState* state, bool* key_range, MemtableNode** pending) {
+    Filter* filter = &statement->filter;
+    Memtable* memtable = table->memtable;
+    Column primary_key = (table->flags & META_FLAG_STRING_KEY) ? COLUMN_STRING_KEY : COLUMN_ID;
+    *key_range = filter->column == primary_key && (filter->type != FILTER_PREFIX || !descending);
+    *pending = NULL;
+    if (*key_range && descending) {
+        // 降序的区间从上界所在的行开始
+        Key high;
+        filter_key(filter, true, &high);
+        uint32_t rank = tree_rank(table, snapshot, root_page_num, &high, true);
+        if (memtable != NULL) {
+            *pending = memtable_seek_last(memtable, &high);
+        }
+        return tree_seek_position(table, snapshot, root_page_num, rank > 0 ? rank - 1 : UINT32_MAX);
+    }
+    if (*key_range) {
+        Key low;
+        filter_key(filter, false, &low);
+        if (memtable != NULL) {
+            *pending = memtable_seek(memtable, &low, NULL);
+        }
+        Cursor* cursor = tree_seek(table, snapshot, root_page_num, &low);
+        cursor_skip_leaf_end(cursor);
+        return cursor;
+    }
+    if (filter->column == COLUMN_NONE && state->skip > 0 && (memtable == NULL || memtable->num_rows == 0)) {
+        // 整棵树都在跳过的范围内时只扣除行数
+        uint32_t num_rows = tree_num_rows(table, snapshot, root_page_num);
+        uint32_t position = UINT32_MAX;
+        if (state->skip < num_rows) {
+            position = descending ? num_rows - 1 - state->skip : state->skip;
+        }
+        state->skip = state->skip < num_rows ? 0 : state->skip - num_rows;
+        return tree_seek_position(table, snapshot, root_page_num, position);
+    }
+    if (memtable != NULL) {
+        *pending = descending ? memtable_last(memtable) : memtable_first(memtable);
+    }
+    return descending ? tree_end(table, snapshot, root_page_num) : tree_start(table, snapshot, root_page_num);
+}
+
+// count(*) 不带条件或带主键区间时，由子树行数直接算出，不访问叶节点
+bool select_count_by_rank(Statement* statement, Table* table, Snapshot* snapshot, uint32_t root_page_num,
+                          uint32_t* num_rows) {
+    Filter* filter = &statement->filter;
+    Memtable* memtable = table->memtable;
+    Column primary_key = (table->flags & META_FLAG_STRING_KEY) ? COLUMN_STRING_KEY : COLUMN_ID;
+    if (filter->column == COLUMN_NONE) {
+        *num_rows = tree_num_rows(table, snapshot, root_page_num) + (memtable != NULL ? memtable->num_rows : 0);
+        return true;
+    }
+    if (filter->column != primary_key || filter->type != FILTER_BETWEEN) {
+        return false;
+    }
+    Key low;
+    Key high;
+    filter_key(filter, false, &low);
+    filter_key(filter, true, &high);
+    uint32_t before = tree_rank(table, snapshot, root_page_num, &low, false);
+    uint32_t through = tree_rank(table, snapshot, root_page_num, &high, true);
+    *num_rows = through > before ? through - before : 0;
+    if (memtable != NULL) {
+        for (MemtableNode* node = memtable_seek(memtable, &low, NULL);
+             node != NULL && compare_keys(&node->key, &high) <= 0; node = node->next[0]) {
+            (*num_rows)++;
+        }
+    }
+    return true;
+}
+
+// 主键 in 列表：批量点查，结果按主键顺序输出
+void select_multi_get(Statement* statement, Table* table, Snapshot* snapshot, uint32_t root_page_num,
+                      SelectState* state) {
+    if (state->num_keys == 0) {
+        return;
+    }
+    void** values = malloc(state->num_keys * sizeof(void*));
+    uint32_t num_keys = table_multi_get(table, snapshot, root_page_num, state->keys, state->num_keys, values);
+    for (uint32_t i = 0; i < num_keys && (statement->count || state->count < statement->limit); i++) {
+        void* value = values[statement->descending ? num_keys - 1 - i : i];
+        if (value == NULL) {
+            continue;
+        }
+        if (state->skip > 0) {
+            state->skip--;
+            continue;
+        }
+        if (!statement->count) {
+            print_columns(value, &table->schema, state->columns, state->num_columns);
+        }
+        state->count++;
+    }
+    free(values);
+}
+
+// 在一个表上执行 select，输出的行数累计到 state 中。
+// 影子分页模式下在快照上扫描，不受并发写入影响。
+// 降序从最右叶节点开始向左扫描，带 limit 时只访问需要的叶节点。
+// 写入模式下树和内存表按主键归并输出，两边的键不会重复。
+void select_table(Statement* statement, Table* table, SelectState* state) {
+    Column primary_key = (table->flags & META_FLAG_STRING_KEY) ? COLUMN_STRING_KEY : COLUMN_ID;
+    Snapshot* snapshot = snapshot_open(table);
+    uint32_t root_page_num = snapshot != NULL ? snapshot->root_page_num : table->root_page_num;
+    uint32_t num_rows;
+    if (statement->count && select_count_by_rank(statement, table, snapshot, root_page_num, &num_rows)) {
+        state->count += num_rows;
+    } else if (statement->filter.column == primary_key && statement->filter.type == FILTER_IN) {
+        select_multi_get(statement, table, snapshot, root_page_num, state);
+    } else {
+        // 主键等值至多匹配一行，两边都从查找位置向右找即可
+        bool descending = statement->descending &&
+                          !(statement->filter.column == primary_key && statement->filter.type == FILTER_EQUAL);
+        bool key_range;
+        MemtableNode* pending;
+        Cursor* cursor = select_start(statement, table, snapshot, root_page_num, descending, state, &key_range,
+                                      &pending);
+        while ((!(cursor->end_of_table) || pending != NULL) &&
+               (statement->count || state->count < statement->limit)) {
+            bool from_tree = pending == NULL;
+            if (!(cursor->end_of_table) && pending != NULL) {
+                Key tree_key;
+                key_from_value(table->flags & META_FLAG_STRING_KEY, cursor_value(cursor), &tree_key);
+                int result = compare_keys(&tree_key, &pending->key);
+                from_tree = descending ? result > 0 : result < 0;
+            }
+            void* value = from_tree ? cursor_value(cursor) : pending->value;
+            if (filter_matches(&statement->filter, value)) {
+                if (state->skip > 0) {
+                    state->skip--;
+                } else {
+                    if (!statement->count) {
+                        print_columns(value, &table->schema, state->columns, state->num_columns);
+                    }
+                    state->count++;
+                }
+            } else if (key_range) {
+                break;
+            }
+            if (!from_tree) {
+                pending = descending ? pending->prev : pending->next[0];
+            } else if (descending) {
+                cursor_retreat(cursor);
+            } else {
+                cursor_advance(cursor);
+            }
+        }
+        free(cursor);
+    }
+    if (snapshot != NULL) {
+        snapshot_close(snapshot);
+    }
+}
+
+void partitions_select(Statement* statement, Table* table, SelectState* state);
+
+ExecuteResult execute_select(Statement* statement, Table* table) {
+    Column primary_key = (table->flags & META_FLAG_STRING_KEY) ? COLUMN_STRING_KEY : COLUMN_ID;
+    if (statement->order_by != COLUMN_NONE && statement->order_by != primary_key) {
+        return EXECUTE_NOT_PRIMARY_KEY;
+    }
+    Column all_columns[SCHEMA_MAX_COLUMNS];
+    for (uint32_t i = 0; i < table->schema.num_columns; i++) {
+        all_columns[i] = i + 1;
+    }
+    SelectState state;
+    state.columns = statement->num_columns > 0 ? statement->columns : all_columns;
+    state.num_columns = statement->num_columns > 0 ? statement->num_columns : table->schema.num_columns;
+    // count(*) 的结果只有一行，limit 和 offset 不影响计数
+    state.skip = statement->count ? 0 : statement->offset;
+    state.count = 0;
+    state.keys = statement->filter.keys;
+    state.num_keys = 0;
+    if (statement->filter.type == FILTER_IN) {
+        state.num_keys = sort_unique_keys(statement->filter.keys, statement->filter.num_keys);
+    }
+    if (table->partitions != NULL) {
+        partitions_select(statement, table, &state);
+    } else {
+        select_table(statement, table, &state);
+    }
+    if (statement->count) {
+        fprintf(output_stream, "(%d)\n", state.count);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+// 后台扫描：读者线程在启动时固定的快照上按键序读出全表，全程不加锁，写者同时照常提交。
+// 之后提交的写入对它不可见，结果在 .scan wait 时输出
+typedef struct Scan {
+    Snapshot* snapshot;
+    pthread_t thread;
+    Row* rows;
+    uint32_t num_rows;
+} Scan;
+
+void* scan_run(void* argument) {
+    Scan* scan = argument;
+    Cursor* cursor = snapshot_start(scan->snapshot);
+    uint32_t capacity = 0;
+    while (!(cursor->end_of_table)) {
+        if (scan->num_rows == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            scan->rows = realloc(scan->rows, capacity * sizeof(Row));
+        }
+        deserialize_row(cursor_value(cursor), &scan->rows[scan->num_rows++], table_row_size(scan->snapshot->table));
+        cursor_advance(cursor);
+    }
+    free(cursor);
+    return NULL;
+}
+
+// 快照在这里、由写者所在的线程打开，启动之后的提交一定对扫描不可见
+void table_scan_begin(Table* table) {
+    if (table->partitions != NULL) {
+        fprintf(output_stream, "Scan is not supported for partitioned tables.\n");
+        return;
+    }
+    if (!(table->flags & META_FLAG_COW)) {
+        fprintf(output_stream, "Scan needs a --cow database.\n");
+        return;
+    }
+    if (table->scan != NULL) {
+        fprintf(output_stream, "Scan already running.\n");
+        return;
+    }
+    // 快照只看得到树，先把内存表合并进去
+    table_flush_memtable(table);
+    Snapshot* snapshot = snapshot_open(table);
+    if (snapshot == NULL) {
+        fprintf(output_stream, "Too many snapshot readers.\n");
+        return;
+    }
+    Scan* scan = malloc(sizeof(Scan));
+    scan->snapshot = snapshot;
+    scan->rows = NULL;
+    scan->num_rows = 0;
+    if (pthread_create(&scan->thread, NULL, scan_run, scan) != 0) {
+        printf("Error starting scan thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    table->scan = scan;
+}
+
+// 等待后台扫描结束并释放快照，print 为真时输出扫描到的行
+void table_scan_finish(Table* table, bool print) {
+    Scan* scan = table->scan;
+    if (scan == NULL) {
+        return;
+    }
+    pthread_join(scan->thread, NULL);
+    if (print) {
+        Column all_columns[SCHEMA_MAX_COLUMNS];
+        for (uint32_t i = 0; i < table->schema.num_columns; i++) {
+            all_columns[i] = i + 1;
+        }
+        for (uint32_t i = 0; i < scan->num_rows; i++) {
+            print_columns(scan->rows[i].data, &table->schema, all_columns, table->schema.num_columns);
+        }
+    }
+    snapshot_close(scan->snapshot);
+    free(scan->rows);
+    free(scan);
+    table->scan = NULL;
+}
+
+// 只有还没有写入过行的默认表可以重新定义
+bool table_can_create(Table* table) {
+    return !(table->flags & META_FLAG_SCHEMA) && tree_num_rows(table, NULL, table->root_page_num) == 0 &&
+           (table->memtable == NULL || table->memtable->num_rows == 0);
+}
+
+// 表结构只保存在元数据页中：影子分页模式下立即写一份新的元数据页，就地模式在关闭时随元数据页写出
+void table_set_schema(Table* table, Schema* schema) {
+    table->schema = *schema;
+    table->flags |= META_FLAG_SCHEMA;
+    if (table->flags & META_FLAG_COW) {
+        uint64_t txn_id = atomic_load(&table->committed_txn_id) + 1;
+        table_write_meta(table, txn_id);
+        pager_sync(table->pager);
+        atomic_store(&table->committed_txn_id, txn_id);
+    }
+}
+
+ExecuteResult partitions_create(Statement* statement, Table* table);
+
+ExecuteResult execute_create(Statement* statement, Table* table) {
+    if (table->partitions != NULL) {
+        return partitions_create(statement, table);
+    }
+    if (!table_can_create(table)) {
+        return EXECUTE_TABLE_EXISTS;
+    }
+    table_set_schema(table, &statement->schema);
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_statement(Statement* statement, Table* table) {
+    switch (statement->type) {
+        case (STATEMENT_INSERT):
+            return execute_insert(statement, table);
+        case (STATEMENT_SELECT):
+            return execute_select(statement, table);
+        case (STATEMENT_CREATE):
+            return execute_create(statement, table);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+// 打开数据库文件并跟踪其大小，页面缓存初始化为NULL
+Pager *pager_open(const char *filename, bool direct) {
+    int fd = open(filename,
+                  O_RDWR |      // Read/Write mode
+                  O_CREAT |  // Create file if it does not exist
+                  (direct ? O_DIRECT : 0),
+                  S_IWUSR |     // User write permission
+                  S_IRUSR   // User read permission
+    );
+
+    if (fd == -1) {
+        if (direct && errno == EINVAL) {
+            printf("File system does not support O_DIRECT.\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("Unable to open file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    off_t file_length = lseek(fd, 0, SEEK_END);
+
+    Pager *pager = malloc(sizeof(Pager));
+    pager->filename = strdup(filename);
+    pager->file_descriptor = fd;
+    pager->file_length = file_length;
+    pager->num_pages = (file_length / PAGE_SIZE);
+    pager->direct = direct;
+
+    // 页框区按页对齐，满足 O_DIRECT 对缓冲区的要求；缓存较大时可由透明大页支撑，减少 TLB 缺失
+    pager->frames = mmap(NULL, TABLE_MAX_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pager->frames == MAP_FAILED) {
+        printf("Error allocating page frames: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    madvise(pager->frames, TABLE_MAX_PAGES * PAGE_SIZE, MADV_HUGEPAGE);
+
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        pager->pages[i] = NULL;
+        pager->dirty[i] = false;
+    }
+    pager->num_dirty_pages = 0;
+    pager->num_free_pages = 0;
+    pager->num_pending_pages = 0;
+    pager->map = NULL;
+    pager->backup = NULL;
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        atomic_init(&pager->referenced[i], false);
+    }
+    pager->warm_pages = NULL;
+    pager->num_warm_pages = 0;
+    pager->next_warm_page = 0;
+    pager->compressed = false;
+    pager->num_free_extents = 0;
+    pager->num_released_extents = 0;
+    memset(pager->page_map, 0, sizeof(pager->page_map));
+
+    return pager;
+}
+
+// 崩溃时未提交事务写到文件末尾的页在这里被丢弃
+void table_truncate_uncommitted(Table* table) {
+    Pager* pager = table->pager;
+    if (ftruncate(pager->file_descriptor, (off_t)pager->num_pages * PAGE_SIZE) == -1) {
+        printf("Error truncating db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->file_length = pager->num_pages * PAGE_SIZE;
+}
+
+// 最初的格式没有元数据页，根节点固定在第 0 页
+bool table_is_legacy(Pager* pager) {
+    if (pager->file_length % PAGE_SIZE != 0) {
+        return false;
+    }
+    void* root_node = get_page(pager, 0);
+    return *(uint32_t*)root_node != META_MAGIC && get_node_type(root_node) <= NODE_LEAF && is_node_root(root_node);
+}
+
+void table_migrate(Table* table);
+
+// 创建表。flags 只在新建数据库时生效，已有数据库沿用元数据页中记录的模式。
+// 旧格式的文件在打开时迁移到当前格式
+void table_open(Table* table, const char* filename, uint32_t flags) {
+    Pager* pager = pager_open(filename, flags & OPEN_FLAG_DIRECT);
+    flags &= ~(OPEN_FLAG_DIRECT | OPEN_FLAG_INGEST | OPEN_FLAG_WARM);
+    table->pager = pager;
+    for (uint32_t i = 0; i < MAX_SNAPSHOT_READERS; i++) {
+        atomic_init(&table->readers[i], 0);
+    }
+    atomic_init(&table->committed_txn_id, 0);
+    table->scan = NULL;
+
+    if (pager->num_pages == 0) {
+        // 新数据库：前两页留给元数据，根节点从第 2 页开始
+        table->flags = flags;
+        table->root_page_num = META_PAGE_COUNT;
+        default_schema(&table->schema);
+        void* root_node = get_page(pager, table->root_page_num);
+        if (table->flags & META_FLAG_COMPRESSED) {
+            pager_disable_direct_io(pager);
+            pager->compressed = true;
+            pager->extent_end = (META_PAGE_COUNT + PAGE_MAP_PAGES) * PAGE_SIZE;
+        }
+        initialize_leaf_node(root_node);
+        set_node_root(root_node, true);
+        pager_mark_dirty(pager, table->root_page_num);
+    } else {
+        MetaPage meta;
+        bool found = table_read_meta(table, &meta);
+        if (!found && table_is_legacy(pager)) {
+            // 最初的格式只有整数主键、原地写入
+            table->flags = 0;
+            table->root_page_num = 0;
+            default_schema(&table->schema);
+            table_migrate(table);
+            return;
+        }
+        if (!found) {
+            MetaPage* first = get_page(pager, 0);
+            if (first->magic == META_MAGIC && first->version > META_VERSION) {
+                printf("Db file version %d is not supported.\n", first->version);
+                exit(EXIT_FAILURE);
+            }
+            printf("Db file has no valid meta page. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+        table->flags = meta.flags;
+        if (table->flags & META_FLAG_COMPRESSED) {
+            pager_disable_direct_io(pager);
+            pager_load_page_map(pager);
+        } else if (pager->file_length % PAGE_SIZE != 0) {
+            // 只有压缩文件按区段对齐，其余文件必须是整页
+            printf("Db file is not a whole number of pages. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+        table->root_page_num = meta.root_page_num;
+        pager->num_pages = meta.num_pages;
+        if (meta.version < META_VERSION) {
+            // 版本 1、2 的内部节点没有子树行数，也没有表结构
+            default_schema(&table->schema);
+            table_migrate(table);
+            return;
+        }
+        atomic_init(&table->committed_txn_id, meta.txn_id);
+        // 空闲页表随元数据页一起提交，打开时不必遍历整棵树
+        pager->num_free_pages = meta.num_free_pages;
+        void* meta_page = get_page(pager, meta.txn_id % META_PAGE_COUNT);
+        memcpy(pager->free_pages, meta_free_pages(meta_page), meta.num_free_pages * sizeof(uint32_t));
+        if (table->flags & META_FLAG_SCHEMA) {
+            memcpy(&table->schema, meta_schema(meta_page), sizeof(Schema));
+        } else {
+            default_schema(&table->schema);
+        }
+        if (table->flags & META_FLAG_COW) {
+            table_truncate_uncommitted(table);
+        }
+    }
+    atomic_init(&table->committed_root_page_num, table->root_page_num);
+
+    if (table->flags & META_FLAG_COW) {
+        // 映射整个可寻址范围，文件增长后无需重新映射
+        pager->map = mmap(NULL, TABLE_MAX_PAGES * PAGE_SIZE, PROT_READ, MAP_SHARED,
+                          pager->file_descriptor, 0);
+        if (pager->map == MAP_FAILED) {
+            printf("Error mapping db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        table_commit(table);
+    }
+}
+
+bool partitions_read_manifest(const char* filename, PartitionManifest* manifest);
+Table* partitions_open(const char* filename, uint32_t flags, PartitionManifest* manifest);
+
+Table* db_open(const char* filename, uint32_t flags) {
+    // 文件中是分区清单时打开各分区
+    PartitionManifest manifest;
+    if (partitions_read_manifest(filename, &manifest)) {
+        return partitions_open(filename, flags, &manifest);
+    }
+    Table* table = (Table*)malloc(sizeof(Table));
+    table->partitions = NULL;
+    // 内存表跨越整理时的重新打开，只在这里创建
+    table->memtable = (flags & OPEN_FLAG_INGEST) ? new_memtable() : NULL;
+    table->warm = flags & OPEN_FLAG_WARM;
+    table_open(table, filename, flags);
+    if (table->warm) {
+        pager_load_hot_pages(table->pager);
+    }
+    return table;
+}
+
+// 整理：按键序把全部行重新装入一个新文件，叶节点按填充率装满并占用连续的页，
+// 内部节点自底向上逐层重建，最后改名替换原文件。新文件只含实际用到的页，文件随之收缩。
+// 整个过程在两条语句之间一次完成，改名是原子的，中途崩溃时原文件不受影响。
+typedef struct {
+    Table* table;              // 正在写入的新表
+    bool string_key;
+    uint32_t fill_percent;
+    // 正在填充的叶节点
+    uint32_t num_rows;
+    Row* rows;
+    // 已完成的当前层节点及其子树的最小、最大键
+    uint32_t num_nodes;
+    uint32_t nodes[TABLE_MAX_PAGES];
+    Key min_keys[TABLE_MAX_PAGES];
+    Key max_keys[TABLE_MAX_PAGES];
+} BulkLoader;
+
+void row_key(BulkLoader* loader, Row* row, Key* key) {
+    if (loader->string_key) {
+        key_from_row(row, key);
+    } else {
+        // 整数主键也放进 Key，只用来记录子树的最大键
+        key_from_id(row_id(row), key);
+    }
+}
+
+void bulk_fill_string_entries(BulkLoader* loader, StringLeafEntry* entries, uint8_t* values,
+                              uint32_t num_rows) {
+    uint32_t row_size = table_row_size(loader->table);
+    for (uint32_t i = 0; i < num_rows; i++) {
+        key_from_row(&loader->rows[i], &entries[i].key);
+        entries[i].value = values + i * row_size;
+        serialize_row(&loader->rows[i], entries[i].value, row_size);
+    }
+}
+
+// 把缓冲的行写成一个新叶节点，接在上一个叶节点之后
+void bulk_flush_leaf(BulkLoader* loader) {
+    Table* table = loader->table;
+    // 新库的空根叶节点就在第一个数据页上，第一个叶节点直接用它
+    uint32_t page_num = table->root_page_num;
+    if (loader->num_nodes > 0) {
+        page_num = table_allocate_page(table);
+    }
+    pager_mark_dirty(table->pager, page_num);
+    void* node = get_page(table->pager, page_num);
+    initialize_leaf_node(node);
+    if (loader->num_nodes > 0) {
+        *leaf_node_next_leaf(get_page(table->pager, loader->nodes[loader->num_nodes - 1])) = page_num;
+    }
+
+    uint32_t row_size = table_row_size(table);
+    if (loader->string_key) {
+        StringLeafEntry entries[loader->num_rows];
+        uint8_t values[loader->num_rows * row_size];
+        bulk_fill_string_entries(loader, entries, values, loader->num_rows);
+        string_leaf_encode(node, entries, loader->num_rows, row_size);
+    } else {
+        *leaf_node_num_cells(node) = loader->num_rows;
+        for (uint32_t i = 0; i < loader->num_rows; i++) {
+            *leaf_node_key(node, i, row_size) = row_id(&loader->rows[i]);
+            serialize_row(&loader->rows[i], leaf_node_value(node, i, row_size), row_size);
+        }
+    }
+
+    uint32_t index = loader->num_nodes++;
+    loader->nodes[index] = page_num;
+    if (loader->num_rows > 0) {
+        row_key(loader, &loader->rows[0], &loader->min_keys[index]);
+        row_key(loader, &loader->rows[loader->num_rows - 1], &loader->max_keys[index]);
+    }
+    loader->num_rows = 0;
+}
+
+// 当前叶节点加上 row 后是否超过目标填充率
+bool bulk_leaf_full(BulkLoader* loader, Row* row) {
+    if (loader->num_rows == 0) {
+        return false;
+    }
+    uint32_t row_size = table_row_size(loader->table);
+    if (!loader->string_key) {
+        uint32_t capacity = leaf_node_max_cells(row_size) * loader->fill_percent / 100;
+        return loader->num_rows >= (capacity > 0 ? capacity : 1);
+    }
+    if (loader->num_rows >= string_leaf_max_cells(row_size)) {
+        return true;
+    }
+    StringLeafEntry entries[loader->num_rows + 1];
+    uint8_t values[(loader->num_rows + 1) * row_size];
+    loader->rows[loader->num_rows] = *row;
+    bulk_fill_string_entries(loader, entries, values, loader->num_rows + 1);
+    return string_leaf_encoded_size(entries, loader->num_rows + 1, row_size) >
+           PAGE_SIZE * loader->fill_percent / 100;
+}
+
+void bulk_add_row(BulkLoader* loader, Row* row) {
+    if (bulk_leaf_full(loader, row)) {
+        bulk_flush_leaf(loader);
+    }
+    loader->rows[loader->num_rows++] = *row;
+}
+
+// 子节点 [first, first + count) 组成一个内部节点，写入 parent_index 处
+void bulk_write_internal(BulkLoader* loader, uint32_t first, uint32_t count, uint32_t parent_index,
+                         uint32_t* parents, Key* parent_min_keys, Key* parent_max_keys) {
+    Table* table = loader->table;
+    uint32_t page_num = table_allocate_page(table);
+    void* node = get_page(table->pager, page_num);
+    initialize_internal_node(node);
+    uint32_t rows[STRING_INTERNAL_MAX_KEYS + 1];
+    for (uint32_t i = 0; i < count; i++) {
+        rows[i] = node_num_rows(get_page(table->pager, loader->nodes[first + i]));
+    }
+    if (loader->string_key) {
+        Key separators[STRING_INTERNAL_MAX_KEYS];
+        for (uint32_t i = 0; i + 1 < count; i++) {
+            separators[i] = loader->min_keys[first + i + 1];
+            separators[i].length = common_prefix_length(&loader->max_keys[first + i], &separators[i]) + 1;
+        }
+        string_internal_encode(node, loader->nodes + first, rows, separators, count - 1);
+    } else {
+        *internal_node_num_keys(node) = count - 1;
+        for (uint32_t i = 0; i + 1 < count; i++) {
+            *internal_node_cell(node, i) = loader->nodes[first + i];
+            *internal_node_key(node, i) = key_as_id(&loader->max_keys[first + i]);
+            *internal_node_child_rows(node, i) = rows[i];
+        }
+        *internal_node_right_child(node) = loader->nodes[first + count - 1];
+        *internal_node_child_rows(node, count - 1) = rows[count - 1];
+    }
+    parents[parent_index] = page_num;
+    parent_min_keys[parent_index] = loader->min_keys[first];
+    parent_max_keys[parent_index] = loader->max_keys[first + count - 1];
+}
+
+// 按子节点能放进一个内部节点的数量分组，最后一组至少两个子节点
+uint32_t bulk_internal_group_size(BulkLoader* loader, uint32_t first) {
+    uint32_t remaining = loader->num_nodes - first;
+    uint32_t count;
+    if (loader->string_key) {
+        uint32_t size = INTERNAL_NODE_HEADER_SIZE;
+        count = 1;
+        while (count < remaining && count <= STRING_INTERNAL_MAX_KEYS) {
+            Key separator = loader->min_keys[first + count];
+            uint32_t length = common_prefix_length(&loader->max_keys[first + count - 1], &separator) + 1;
+            if (size + INTERNAL_NODE_CELL_SIZE + length > PAGE_SIZE) {
+                break;
+            }
+            size += INTERNAL_NODE_CELL_SIZE + length;
+            count++;
+        }
+    } else {
+        count = remaining < INTERNAL_NODE_MAX_CELLS + 1 ? remaining : INTERNAL_NODE_MAX_CELLS + 1;
+    }
+    if (remaining - count == 1) {
+        count--;
+    }
+    return count;
+}
+
+// 逐层向上建内部节点，直到只剩一个根
+void bulk_finish(BulkLoader* loader) {
+    Table* table = loader->table;
+    if (loader->num_rows > 0 || loader->num_nodes == 0) {
+        bulk_flush_leaf(loader);
+    }
+    while (loader->num_nodes > 1) {
+        uint32_t parents[TABLE_MAX_PAGES];
+        Key parent_min_keys[TABLE_MAX_PAGES];
+        Key parent_max_keys[TABLE_MAX_PAGES];
+        uint32_t num_parents = 0;
+        for (uint32_t first = 0; first < loader->num_nodes;) {
+            uint32_t count = bulk_internal_group_size(loader, first);
+            bulk_write_internal(loader, first, count, num_parents++, parents, parent_min_keys, parent_max_keys);
+            first += count;
+        }
+        memcpy(loader->nodes, parents, num_parents * sizeof(uint32_t));
+        memcpy(loader->min_keys, parent_min_keys, num_parents * sizeof(Key));
+        memcpy(loader->max_keys, parent_max_keys, num_parents * sizeof(Key));
+        loader->num_nodes = num_parents;
+    }
+    table->root_page_num = loader->nodes[0];
+    set_node_root(get_page(table->pager, table->root_page_num), true);
+}
+
+// 正在使用原文件、不允许整体重写的原因，没有时返回 NULL
+const char* table_rewrite_conflict(Table* table) {
+    if (table->pager->backup != NULL) {
+        return "Backup in progress.";
+    }
+    for (uint32_t slot = 0; slot < MAX_SNAPSHOT_READERS; slot++) {
+        if (atomic_load(&table->readers[slot]) != 0) {
+            return "Snapshots are open.";
+        }
+    }
+    return NULL;
+}
+
+// 整理或分裂前确认没有备份和快照读者还在使用原文件
+bool table_can_rewrite(Table* table) {
+    const char* conflict = table_rewrite_conflict(table);
+    if (conflict != NULL) {
+        fprintf(output_stream, "%s\n", conflict);
+        return false;
+    }
+    return true;
+}
+
+// 新建文件 path，准备按键序装入与 table 同样模式和表结构的行
+BulkLoader* bulk_open(Table* table, const char* path, uint32_t fill_percent) {
+    char* hot_path = hot_pages_path(path);
+    unlink(path);
+    unlink(hot_path);
+    free(hot_path);
+
+    BulkLoader* loader = malloc(sizeof(BulkLoader));
+    loader->table = db_open(path, table->flags | (table->pager->direct ? OPEN_FLAG_DIRECT : 0));
+    loader->table->schema = table->schema;
+    loader->string_key = table->flags & META_FLAG_STRING_KEY;
+    loader->fill_percent = fill_percent;
+    loader->num_rows = 0;
+    loader->num_nodes = 0;
+    // 多留一个位置给判断是否已满时试放的行
+    uint32_t row_size = table_row_size(table);
+    uint32_t max_rows = loader->string_key ? string_leaf_max_cells(row_size) : leaf_node_max_cells(row_size);
+    loader->rows = malloc((max_rows + 1) * sizeof(Row));
+    return loader;
+}
+
+// 建好内部节点并关闭新文件。装载用的表不记录热页，新文件不带热页表
+void bulk_close(BulkLoader* loader) {
+    bulk_finish(loader);
+    db_close(loader->table);
+    free(loader->rows);
+    free(loader);
+}
+
+// 从 cursor 和内存表的 *pending 处开始按键序归并，把键小于 end（NULL 表示不限）的行装入新文件 path。
+// 返回时两者都停在第一个没有复制的行上
+void table_copy_rows(Table* table, Cursor* cursor, MemtableNode** pending, Key* end, const char* path,
+                     uint32_t fill_percent) {
+    bool string_key = table->flags & META_FLAG_STRING_KEY;
+    uint32_t row_size = table_row_size(table);
+    BulkLoader* loader = bulk_open(table, path, fill_percent);
+    Row row;
+    while (!(cursor->end_of_table) || (pending != NULL && *pending != NULL)) {
+        bool from_tree = pending == NULL || *pending == NULL;
+        Key key;
+        if (!(cursor->end_of_table)) {
+            key_from_value(string_key, cursor_value(cursor), &key);
+        }
+        if (!from_tree && (cursor->end_of_table || compare_keys(&(*pending)->key, &key) < 0)) {
+            key = (*pending)->key;
+        } else {
+            from_tree = true;
+        }
+        if (end != NULL && compare_keys(&key, end) >= 0) {
+            break;
+        }
+        if (from_tree) {
+            deserialize_row(cursor_value(cursor), &row, row_size);
+            cursor_advance(cursor);
+        } else {
+            deserialize_row((*pending)->value, &row, row_size);
+            *pending = (*pending)->next[0];
+        }
+        bulk_add_row(loader, &row);
+    }
+    bulk_close(loader);
+}
+
+// 原文件的缓存不再需要刷盘，直接丢弃后换成新文件。页号全部改变，原来的热页表作废
+void table_replace_file(Table* table, const char* path) {
+    Pager* pager = table->pager;
+    char* filename = strdup(pager->filename);
+    char* hot_path = hot_pages_path(filename);
+    uint32_t flags = table->flags | (pager->direct ? OPEN_FLAG_DIRECT : 0);
+    unlink(hot_path);
+    pager_close(pager);
+    if (rename(path, filename) == -1) {
+        printf("Error replacing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    sync_directory(filename);
+    table_open(table, filename, flags);
+    free(hot_path);
+    free(filename);
+}
+
+// 把树和内存表中的行一起按键序装入新文件并替换原文件，内存表随之清空
+void table_rewrite(Table* table, uint32_t fill_percent) {
+    char* temp_path = malloc(strlen(table->pager->filename) + 8);
+    sprintf(temp_path, "%s.vacuum", table->pager->filename);
+    Cursor* cursor = table_start(table);
+    MemtableNode* pending = table->memtable != NULL ? memtable_first(table->memtable) : NULL;
+    table_copy_rows(table, cursor, &pending, NULL, temp_path, fill_percent);
+    free(cursor);
+    if (table->memtable != NULL) {
+        memtable_remove_first(table->memtable, table->memtable->num_rows);
+    }
+    table_replace_file(table, temp_path);
+    free(temp_path);
+}
+
+// 合并内存表。逐叶合并因页面碎片放不下时，连同内存表按 100% 填充率整体重写一次；
+// 写入时已确认过这样放得下，只有备份或快照占着原文件时返回 false
+bool table_merge_memtable(Table* table) {
+    if (table_flush_memtable(table)) {
+        return true;
+    }
+    if (table_rewrite_conflict(table) != NULL) {
+        return false;
+    }
+    table_rewrite(table, 100);
+    return true;
+}
+
+// 旧格式文件（没有元数据页的最初格式和版本 1、2）的迁移。叶节点格式一直没有变，旧的内部节点单元格只有子节点页号和键，没有子树行数。
+// 按旧布局依次找出叶节点，把行按键序装入新文件，再替换原文件
+const uint32_t LEGACY_INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+
+void legacy_collect_leaves(Table* table, uint32_t page_num, uint32_t depth, uint32_t* leaves,
+                           uint32_t* num_leaves, uint32_t* num_rows) {
+    if (depth >= TREE_MAX_HEIGHT || page_num >= TABLE_MAX_PAGES || *num_leaves >= TABLE_MAX_PAGES) {
+        printf("Db file has an invalid legacy tree. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+    void* node = get_page(table->pager, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t row_size = table_row_size(table);
+        uint32_t max_cells =
+                table->flags & META_FLAG_STRING_KEY ? string_leaf_max_cells(row_size) : leaf_node_max_cells(row_size);
+        if (*leaf_node_num_cells(node) > max_cells) {
+            printf("Db file has an invalid legacy tree. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+        leaves[(*num_leaves)++] = page_num;
+        *num_rows += *leaf_node_num_cells(node);
+        return;
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (num_keys > (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / LEGACY_INTERNAL_NODE_CELL_SIZE) {
+        printf("Db file has an invalid legacy tree. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < num_keys; i++) {
+        uint32_t child = *(uint32_t*)(node + INTERNAL_NODE_HEADER_SIZE + i * LEGACY_INTERNAL_NODE_CELL_SIZE);
+        legacy_collect_leaves(table, child, depth + 1, leaves, num_leaves, num_rows);
+    }
+    legacy_collect_leaves(table, *internal_node_right_child(node), depth + 1, leaves, num_leaves, num_rows);
+}
+
+// table 已按旧格式打开，根页号、模式和表结构已设好。返回时 table 已换成迁移后的文件
+void table_migrate(Table* table) {
+    uint32_t leaves[TABLE_MAX_PAGES];
+    uint32_t num_leaves = 0;
+    uint32_t num_rows = 0;
+    legacy_collect_leaves(table, table->root_page_num, 0, leaves, &num_leaves, &num_rows);
+    if (table_packed_pages(table, num_rows) > TABLE_MAX_PAGES - META_PAGE_COUNT) {
+        printf("Db file is too large to migrate.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char* temp_path = malloc(strlen(table->pager->filename) + sizeof(".migrate"));
+    sprintf(temp_path, "%s.migrate", table->pager->filename);
+    BulkLoader* loader = bulk_open(table, temp_path, 100);
+    bool string_key = table->flags & META_FLAG_STRING_KEY;
+    uint32_t row_size = table_row_size(table);
+    Row row;
+    for (uint32_t i = 0; i < num_leaves; i++) {
+        void* node = get_page(table->pager, leaves[i]);
+        for (uint32_t cell_num = 0; cell_num < *leaf_node_num_cells(node); cell_num++) {
+            void* value = string_key ? string_leaf_value(node, cell_num) : leaf_node_value(node, cell_num, row_size);
+            deserialize_row(value, &row, row_size);
+            bulk_add_row(loader, &row);
+        }
+    }
+    bulk_close(loader);
+    table_replace_file(table, temp_path);
+    free(temp_path);
+    printf("Migrated db file to version %d.\n", META_VERSION);
+}
+
+bool table_vacuum(Table* table, uint32_t fill_percent) {
+    if (!table_can_rewrite(table)) {
+        return false;
+    }
+    // 先把内存表合并进树，页数统计包含合并用到的页
+    table_flush_memtable(table);
+    uint32_t old_num_pages = table->pager->num_pages;
+    table_rewrite(table, fill_percent);
+    fprintf(output_stream, "Vacuumed %d pages into %d.\n", old_num_pages, table->pager->num_pages);
+    return true;
+}
+
+// 分区表：按 id 把主键空间切成若干区间，每个区间是一个有自己页缓存和文件描述符的数据库文件。
+// 插入和点查直接路由到所在分区；扫描按分区顺序依次进行，结果自然按主键有序。
+// 写入模式下各分区的内存表由多个线程并行合并进各自的树，关闭时各分区也并行刷盘。
+// 分区写满时从中间一分为二，也可以用 .split 手动拆分热点区间。
+typedef struct Partitions {
+    char* filename;        // 清单文件
+    uint32_t flags;        // 打开分区时使用的标志
+    PartitionManifest manifest;
+    Table* tables[MAX_PARTITIONS];
+} Partitions;
+
+uint32_t manifest_checksum(PartitionManifest* manifest) {
+    return fnv_hash(2166136261u, (uint8_t*)manifest, offsetof(PartitionManifest, checksum));
+}
+
+char* partition_path(const char* filename, uint32_t file_id) {
+    char* path = malloc(strlen(filename) + 12);
+    sprintf(path, "%s.%u", filename, file_id);
+    return path;
+}
+
+// 读取分区清单，文件不存在或是普通数据库时返回 false
+bool partitions_read_manifest(const char* filename, PartitionManifest* manifest) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    ssize_t length = read(fd, manifest, sizeof(PartitionManifest));
+    close(fd);
+    if (length < (ssize_t)sizeof(uint32_t) || manifest->magic != PARTITION_MAGIC) {
+        return false;
+    }
+    if (length != sizeof(PartitionManifest) || manifest->checksum != manifest_checksum(manifest) ||
+        manifest->num_partitions == 0 || manifest->num_partitions > MAX_PARTITIONS) {
+        printf("Partition manifest is corrupt.\n");
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+// 清单先写入临时文件再改名替换，中途崩溃时仍是完整的旧清单
+void partitions_write_manifest(Partitions* partitions) {
+    PartitionManifest* manifest = &partitions->manifest;
+    manifest->magic = PARTITION_MAGIC;
+    manifest->checksum = manifest_checksum(manifest);
+    char* temp_path = malloc(strlen(partitions->filename) + 10);
+    sprintf(temp_path, "%s.manifest", partitions->filename);
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd == -1 || write(fd, manifest, sizeof(PartitionManifest)) != sizeof(PartitionManifest) ||
+        fsync(fd) == -1) {
+        printf("Error writing partition manifest: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    if (rename(temp_path, partitions->filename) == -1) {
+        printf("Error replacing partition manifest: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    // 清单和新分区文件的目录项落盘之后，才能删除被替换的分区文件
+    sync_directory(partitions->filename);
+    free(temp_path);
+}
+
+Table* partitions_open(const char* filename, uint32_t flags, PartitionManifest* manifest) {
+    Partitions* partitions = malloc(sizeof(Partitions));
+    partitions->filename = strdup(filename);
+    partitions->flags = flags;
+    partitions->manifest = *manifest;
+    for (uint32_t i = 0; i < manifest->num_partitions; i++) {
+        char* path = partition_path(filename, manifest->file_ids[i]);
+        // 清单中的分区文件不见了就是损坏，不能当作空分区重新建
+        if (access(path, F_OK) == -1) {
+            printf("Partition file %s is missing. Corrupt file.\n", path);
+            exit(EXIT_FAILURE);
+        }
+        partitions->tables[i] = db_open(path, flags);
+        free(path);
+    }
+    Table* table = (Table*)malloc(sizeof(Table));
+    table->pager = NULL;
+    table->memtable = NULL;
+    table->scan = NULL;
+    table->warm = false;
+    table->partitions = partitions;
+    table->root_page_num = 0;
+    table->flags = partitions->tables[0]->flags;
+    table->schema = partitions->tables[0]->schema;
+    return table;
+}
+
+// 新建分区表，bounds 是第二个分区起各分区的下界。已有的数据库不能再指定分区
+Table* db_open_partitioned(const char* filename, uint32_t flags, uint32_t* bounds, uint32_t num_bounds) {
+    int fd = open(filename, O_RDONLY);
+    if (fd != -1) {
+        off_t length = lseek(fd, 0, SEEK_END);
+        close(fd);
+        if (length > 0) {
+            printf("Db file already exists. --partitions only applies to a new database.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    PartitionManifest manifest;
+    memset(&manifest, 0, sizeof(manifest));
+    manifest.num_partitions = num_bounds + 1;
+    for (uint32_t i = 0; i < manifest.num_partitions; i++) {
+        manifest.lows[i] = i == 0 ? 0 : bounds[i - 1];
+        manifest.file_ids[i] = i + 1;
+        // 建出空的分区文件，同名的残留文件一并清空
+        char* path = partition_path(filename, manifest.file_ids[i]);
+        char* hot_path = hot_pages_path(path);
+        int partition_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+        if (partition_fd == -1) {
+            printf("Unable to open file\n");
+            exit(EXIT_FAILURE);
+        }
+        close(partition_fd);
+        unlink(hot_path);
+        free(path);
+        free(hot_path);
+    }
+    manifest.next_file_id = manifest.num_partitions + 1;
+    Table* table = partitions_open(filename, flags, &manifest);
+    partitions_write_manifest(table->partitions);
+    return table;
+}
+
+// 包含 id 的分区
+uint32_t partition_find(PartitionManifest* manifest, uint32_t id) {
+    uint32_t min_index = 0;
+    uint32_t max_index = manifest->num_partitions;
+    while (max_index - min_index > 1) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (manifest->lows[index] <= id) {
+            min_index = index;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+// 每个参数一个线程执行 routine，全部结束后返回。线程创建失败时就地执行
+void run_parallel(void** arguments, uint32_t count, void* (*routine)(void*)) {
+    pthread_t threads[MAX_PARTITIONS];
+    bool started[MAX_PARTITIONS];
+    for (uint32_t i = 0; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, routine, arguments[i]) == 0;
+        if (!started[i]) {
+            routine(arguments[i]);
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+void partitions_run_parallel(Table** tables, uint32_t count, void* (*routine)(void*)) {
+    void* arguments[MAX_PARTITIONS];
+    for (uint32_t i = 0; i < count; i++) {
+        arguments[i] = tables[i];
+    }
+    run_parallel(arguments, count, routine);
+}
+
+void* partition_flush_memtable(void* table) {
+    table_flush_memtable(table);
+    return NULL;
+}
+
+void* partition_close(void* table) {
+    db_close(table);
+    return NULL;
+}
+
+// 把第 index 个分区在 split_id 处一分为二，split_id 为 0 时取树中间的行。
+// 两半各自装入一个新文件（内存表一并合并），清单改名生效之后才删除原文件
+bool partitions_split(Partitions* partitions, uint32_t index, uint32_t split_id) {
+    PartitionManifest* manifest = &partitions->manifest;
+    Table* table = partitions->tables[index];
+    if (manifest->num_partitions >= MAX_PARTITIONS) {
+        fprintf(output_stream, "Too many partitions.\n");
+        return false;
+    }
+    if (!table_can_rewrite(table)) {
+        return false;
+    }
+    if (split_id == 0) {
+        uint32_t num_rows = tree_num_rows(table, NULL, table->root_page_num);
+        if (num_rows < 2) {
+            return false;
+        }
+        Cursor* cursor = tree_seek_position(table, NULL, table->root_page_num, num_rows / 2);
+        Key key;
+        key_from_value(false, cursor_value(cursor), &key);
+        split_id = key_as_id(&key);
+        free(cursor);
+    }
+
+    uint32_t lower_file_id = manifest->next_file_id++;
+    uint32_t upper_file_id = manifest->next_file_id++;
+    char* lower_path = partition_path(partitions->filename, lower_file_id);
+    char* upper_path = partition_path(partitions->filename, upper_file_id);
+    Key end;
+    key_from_id(split_id, &end);
+    Cursor* cursor = table_start(table);
+    MemtableNode* pending = table->memtable != NULL ? memtable_first(table->memtable) : NULL;
+    table_copy_rows(table, cursor, &pending, &end, lower_path, DEFAULT_FILL_PERCENT);
+    table_copy_rows(table, cursor, &pending, NULL, upper_path, DEFAULT_FILL_PERCENT);
+    free(cursor);
+
+    uint32_t num_after = manifest->num_partitions - index - 1;
+    memmove(&manifest->lows[index + 2], &manifest->lows[index + 1], num_after * sizeof(uint32_t));
+    memmove(&manifest->file_ids[index + 2], &manifest->file_ids[index + 1], num_after * sizeof(uint32_t));
+    memmove(&partitions->tables[index + 2], &partitions->tables[index + 1], num_after * sizeof(Table*));
+    manifest->lows[index + 1] = split_id;
+    manifest->file_ids[index] = lower_file_id;
+    manifest->file_ids[index + 1] = upper_file_id;
+    manifest->num_partitions++;
+    partitions_write_manifest(partitions);
+
+    // 原分区的行都已在新文件中，缓存和内存表直接丢弃
+    char* old_path = strdup(table->pager->filename);
+    char* old_hot_path = hot_pages_path(old_path);
+    pager_close(table->pager);
+    if (table->memtable != NULL) {
+        free_memtable(table->memtable);
+    }
+    free(table);
+    unlink(old_path);
+    unlink(old_hot_path);
+    free(old_path);
+    free(old_hot_path);
+
+    partitions->tables[index] = db_open(lower_path, partitions->flags);
+    partitions->tables[index + 1] = db_open(upper_path, partitions->flags);
+    free(lower_path);
+    free(upper_path);
+    return true;
+}
+
+void partitions_split_at(Table* table, uint32_t id) {
+    Partitions* partitions = table->partitions;
+    uint32_t index = partition_find(&partitions->manifest, id);
+    if (partitions->manifest.lows[index] == id) {
+        fprintf(output_stream, "Partition boundary already exists.\n");
+        return;
+    }
+    if (partitions_split(partitions, index, id)) {
+        fprintf(output_stream, "Split partition at %d.\n", id);
+    }
+}
+
+// 并行合并选中分区的内存表。页数不够没能合并完的分区从中间分裂，剩下的行随之写进新文件。
+// 从后往前分裂，前面分区的下标不变
+void partitions_flush_memtables(Partitions* partitions, bool* selected) {
+    Table* tables[MAX_PARTITIONS];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < partitions->manifest.num_partitions; i++) {
+        if (selected[i]) {
+            tables[count++] = partitions->tables[i];
+        }
+    }
+    partitions_run_parallel(tables, count, partition_flush_memtable);
+    for (uint32_t i = partitions->manifest.num_partitions; i-- > 0;) {
+        Memtable* memtable = partitions->tables[i]->memtable;
+        if (selected[i] && memtable->num_rows > 0) {
+            partitions_split(partitions, i, 0);
+        }
+    }
+}
+
+// 各分区只访问自己的页缓存和文件，关闭时并行合并内存表，再并行刷盘
+void partitions_close(Table* table) {
+    Partitions* partitions = table->partitions;
+    if (partitions->tables[0]->memtable != NULL) {
+        bool selected[MAX_PARTITIONS];
+        for (uint32_t i = 0; i < partitions->manifest.num_partitions; i++) {
+            selected[i] = partitions->tables[i]->memtable->num_rows > 0;
+        }
+        partitions_flush_memtables(partitions, selected);
+    }
+    partitions_run_parallel(partitions->tables, partitions->manifest.num_partitions, partition_close);
+    free(partitions->filename);
+    free(partitions);
+    free(table);
+}
+
+
+// 各分区共用一个表结构，都还是空表时才能定义
+ExecuteResult partitions_create(Statement* statement, Table* table) {
+    Partitions* partitions = table->partitions;
+    for (uint32_t i = 0; i < partitions->manifest.num_partitions; i++) {
+        if (!table_can_create(partitions->tables[i])) {
+            return EXECUTE_TABLE_EXISTS;
+        }
+    }
+    for (uint32_t i = 0; i < partitions->manifest.num_partitions; i++) {
+        table_set_schema(partitions->tables[i], &statement->schema);
+    }
+    table->schema = statement->schema;
+    table->flags |= META_FLAG_SCHEMA;
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult partitions_insert(Statement* statement, Table* table) {
+    Partitions* partitions = table->partitions;
+    uint32_t index = partition_find(&partitions->manifest, row_id(&statement->row_to_insert));
+    Memtable* memtable = partitions->tables[index]->memtable;
+    if (memtable != NULL && memtable->num_rows + 1 >= MEMTABLE_MAX_ROWS) {
+        // 本分区的内存表将满，把攒到一半以上的分区一起合并
+        bool selected[MAX_PARTITIONS];
+        for (uint32_t i = 0; i < partitions->manifest.num_partitions; i++) {
+            selected[i] = i == index || partitions->tables[i]->memtable->num_rows >= MEMTABLE_MAX_ROWS / 2;
+        }
+        partitions_flush_memtables(partitions, selected);
+        index = partition_find(&partitions->manifest, row_id(&statement->row_to_insert));
+    }
+    ExecuteResult result = execute_insert(statement, partitions->tables[index]);
+    // 分区写满时自动分裂，再重试一次
+    if (result == EXECUTE_TABLE_FULL && partitions_split(partitions, index, 0)) {
+        index = partition_find(&partitions->manifest, row_id(&statement->row_to_insert));
+        result = execute_insert(statement, partitions->tables[index]);
+    }
+    return result;
+}
+
+// 一批插入中落在同一分区的语句，由一个线程按原顺序执行
+typedef struct {
+    Table* table;
+    Statement** statements;
+    ExecuteResult* results;
+    uint32_t count;
+    uint32_t num_done; // 已执行的条数，之后的语句留给串行路径
+} PartitionInsertJob;
+
+void* partition_insert_job(void* argument) {
+    PartitionInsertJob* job = argument;
+    Memtable* memtable = job->table->memtable;
+    for (job->num_done = 0; job->num_done < job->count; job->num_done++) {
+        // 内存表将满时要和其他分区一起合并，分区写满时要分裂，都会改动别的分区，停下交给串行路径
+        if (memtable != NULL && memtable->num_rows + 1 >= MEMTABLE_MAX_ROWS) {
+            break;
+        }
+        ExecuteResult result = execute_insert(job->statements[job->num_done], job->table);
+        if (result == EXECUTE_TABLE_FULL) {
+            break;
+        }
+        job->results[job->num_done] = result;
+    }
+    return NULL;
+}
+
+// 一批插入按分区分组，各分区在自己的线程里并行执行，results 按原顺序给出结果。
+// 同一分区的语句保持原顺序，不同分区的键互不相交，结果与逐条执行相同
+void partitions_insert_batch(Table* table, Statement* statements, uint32_t count, ExecuteResult* results) {
+    Partitions* partitions = table->partitions;
+    uint32_t num_partitions = partitions->manifest.num_partitions;
+    uint32_t* indexes = malloc(count * sizeof(uint32_t));
+    uint32_t counts[MAX_PARTITIONS] = {0};
+    for (uint32_t i = 0; i < count; i++) {
+        indexes[i] = partition_find(&partitions->manifest, row_id(&statements[i].row_to_insert));
+        counts[indexes[i]]++;
+    }
+    Statement** grouped = malloc(count * sizeof(Statement*));
+    ExecuteResult* grouped_results = malloc(count * sizeof(ExecuteResult));
+    PartitionInsertJob jobs[MAX_PARTITIONS];
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < num_partitions; i++) {
+        jobs[i] = (PartitionInsertJob){partitions->tables[i], grouped + offset, grouped_results + offset, 0, 0};
+        offset += counts[i];
+    }
+    uint32_t* positions = malloc(count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+        PartitionInsertJob* job = &jobs[indexes[i]];
+        positions[i] = job->count;
+        job->statements[job->count++] = &statements[i];
+    }
+
+    void* arguments[MAX_PARTITIONS];
+    uint32_t num_jobs = 0;
+    for (uint32_t i = 0; i < num_partitions; i++) {
+        if (jobs[i].count > 0) {
+            arguments[num_jobs++] = &jobs[i];
+        }
+    }
+    run_parallel(arguments, num_jobs, partition_insert_job);
+
+    // 没有并行执行完的语句按原顺序走逐条插入的路径，合并内存表和分裂分区都在这里进行
+    for (uint32_t i = 0; i < count; i++) {
+        PartitionInsertJob* job = &jobs[indexes[i]];
+        if (positions[i] < job->num_done) {
+            results[i] = job->results[positions[i]];
+        } else {
+            results[i] = partitions_insert(&statements[i], table);
+        }
+    }
+    free(positions);
+    free(grouped_results);
+    free(grouped);
+    free(indexes);
+}
+
+// 依次在各分区上执行，降序时从最后一个分区开始。条件落在 id 上时跳过不可能匹配的分区，
+// in 列表已排序去重，每个分区只查落在自己区间内的一段
+void partitions_select(Statement* statement, Table* table, SelectState* state) {
+    Partitions* partitions = table->partitions;
+    PartitionManifest* manifest = &partitions->manifest;
+    Filter* filter = &statement->filter;
+    Key* keys = state->keys;
+    uint32_t num_keys = state->num_keys;
+    for (uint32_t i = 0; i < manifest->num_partitions; i++) {
+        if (!statement->count && state->count >= statement->limit) {
+            break;
+        }
+        uint32_t index = statement->descending ? manifest->num_partitions - 1 - i : i;
+        uint32_t low = manifest->lows[index];
+        uint32_t high = index + 1 < manifest->num_partitions ? manifest->lows[index + 1] - 1 : UINT32_MAX;
+        if (filter->column == COLUMN_ID && filter->type == FILTER_IN) {
+            uint32_t first = 0;
+            while (first < num_keys && key_as_id(&keys[first]) < low) {
+                first++;
+            }
+            uint32_t last = first;
+            while (last < num_keys && key_as_id(&keys[last]) <= high) {
+                last++;
+            }
+            if (last == first) {
+                continue;
+            }
+            state->keys = keys + first;
+            state->num_keys = last - first;
+        } else if (filter->column == COLUMN_ID && (filter->type == FILTER_EQUAL || filter->type == FILTER_BETWEEN)) {
+            if (filter_id(filter, false) > high || filter_id(filter, true) < low) {
+                continue;
+            }
+        }
+        select_table(statement, partitions->tables[index], state);
+    }
+}
 
-    return cursor;
+void partitions_print(Table* table) {
+    Partitions* partitions = table->partitions;
+    for (uint32_t i = 0; i < partitions->manifest.num_partitions; i++) {
+        Table* partition = partitions->tables[i];
+        uint32_t num_rows = tree_num_rows(partition, NULL, partition->root_page_num) +
+                            (partition->memtable != NULL ? partition->memtable->num_rows : 0);
+        fprintf(output_stream, "- from %d: %d rows, %s\n", partitions->manifest.lows[i], num_rows,
+                partition->pager->filename);
+    }
 }
 
+void partitions_print_tree(Table* table) {
+    Partitions* partitions = table->partitions;
+    for (uint32_t i = 0; i < partitions->manifest.num_partitions; i++) {
+        fprintf(output_stream, "- partition from %d\n", partitions->manifest.lows[i]);
+        Table* partition = partitions->tables[i];
+        print_tree(partition, partition->root_page_num, 1);
+    }
+}
 
-// 获取指向光标所描述位置的指针
-void* cursor_value(Cursor* cursor) {
-    uint32_t page_num = cursor->page_num;
-    void* page = get_page(cursor->table->pager, page_num);
-    return leaf_node_value(page, cursor->cell_num);
+void partitions_vacuum(Table* table, uint32_t fill_percent) {
+    Partitions* partitions = table->partitions;
+    for (uint32_t i = 0; i < partitions->manifest.num_partitions; i++) {
+        table_vacuum(partitions->tables[i], fill_percent);
+    }
 }
 
-// 每当我们想将光标移过叶节点的末尾时，
-// 都可以检查叶节点是否有同级节点
-void cursor_advance(Cursor* cursor) {
-    uint32_t page_num = cursor->page_num;
-    void* node = get_page(cursor->table->pager, page_num);
-    cursor->cell_num += 1;
-    if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-        /* Advance to next leaf node */
-        uint32_t next_page_num = *leaf_node_next_leaf(node);
-        if (next_page_num == 0) {
-            /* This was rightmost leaf */
-            cursor->end_of_table = true;
-        } else {
-            cursor->page_num = next_page_num;
-            cursor->cell_num = 0;
+// 在线备份只支持单文件的表
+bool table_backup_running(Table* table) {
+    return table->pager != NULL && table->pager->backup != NULL;
+}
+
+// 还有待预热的页的文件，分区表逐个分区预热
+Pager* table_warming_pager(Table* table) {
+    if (table->partitions == NULL) {
+        return table->pager->warm_pages != NULL ? table->pager : NULL;
+    }
+    for (uint32_t i = 0; i < table->partitions->manifest.num_partitions; i++) {
+        Pager* pager = table->partitions->tables[i]->pager;
+        if (pager->warm_pages != NULL) {
+            return pager;
         }
     }
+    return NULL;
 }
 
-/* 处理根节点的分裂。
- * 旧根节点复制到新页，成为左子节点。
- * 右子节点的地址被传递进来。
- * 重新初始化根页以包含新的根节点。
- * 新的根节点指向两个子节点。
-*/
-void create_new_root(Table* table, uint32_t right_child_page_num) {
-    void* root = get_page(table->pager, table->root_page_num);
-    void* right_child = get_page(table->pager, right_child_page_num);
-    uint32_t left_child_page_num = get_unused_page_num(table->pager);
-    void* left_child = get_page(table->pager, left_child_page_num);
-    if (get_node_type(root) == NODE_INTERNAL) {
-        initialize_internal_node(right_child);
-        initialize_internal_node(left_child);
+void table_warm_step(Table* table) {
+    Pager* pager = table_warming_pager(table);
+    if (pager != NULL) {
+        pager_warm_step(pager);
     }
+}
 
+// 输出语句解析失败的原因
+void print_prepare_result(PrepareResult result, InputBuffer* input_buffer) {
+    switch (result) {
+        case (PREPARE_SUCCESS):
+            break;
+        case (PREPARE_NEGATIVE_ID):
+            fprintf(output_stream, "ID must be positive.\n");
+            break;
+        case (PREPARE_STRING_TOO_LONG):
+            fprintf(output_stream, "String is too long.\n");
+            break;
+        case (PREPARE_SYNTAX_ERROR):
+            fprintf(output_stream, "Syntax error. Could not parse statement.\n");
+            break;
+        case (PREPARE_UNRECOGNIZED_STATEMENT):
+            fprintf(output_stream, "Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
+            break;
+        case (PREPARE_INVALID_SCHEMA):
+            fprintf(output_stream, "Invalid table definition.\n");
+            break;
+    }
+}
 
-    /* Left child has data copied from old root */
-    memcpy(left_child, root, PAGE_SIZE);
-    set_node_root(left_child, false);
+// 输出语句的执行结果
+void print_execute_result(ExecuteResult result) {
+    switch (result) {
+        case (EXECUTE_SUCCESS):
+            fprintf(output_stream, "Executed.\n");
+            break;
+        case (EXECUTE_TABLE_FULL):
+            fprintf(output_stream, "Error: Table full.\n");
+            break;
+        case (EXECUTE_DUPLICATE_KEY):
+            fprintf(output_stream, "Error: Duplicate key.\n");
+            break;
+        case (EXECUTE_NOT_PRIMARY_KEY):
+            fprintf(output_stream, "Error: Can only order by the primary key.\n");
+            break;
+        case (EXECUTE_TABLE_EXISTS):
+            fprintf(output_stream, "Error: Table already exists.\n");
+            break;
+    }
+}
 
-    if (get_node_type(left_child) == NODE_INTERNAL) {
-        void* child;
-        for (int i = 0; i < *internal_node_num_keys(left_child); i++) {
-            child = get_page(table->pager, *internal_node_child(left_child,i));
-            *node_parent(child) = left_child_page_num;
+// 处理一行输入：元命令或 SQL 语句，结果写到 output_stream
+void process_input(InputBuffer* input_buffer, Table* table) {
+    if (input_buffer->buffer[0] == '.') {
+        switch (do_meta_command(input_buffer, table)) {
+            case (META_COMMAND_SUCCESS):
+                return;
+            case (META_COMMAND_UNRECOGNIZED_COMMAND):
+                fprintf(output_stream, "Unrecognized command '%s'\n", input_buffer->buffer);
+                return;
         }
-        child = get_page(table->pager, *internal_node_right_child(left_child));
-        *node_parent(child) = left_child_page_num;
+    }
+    // 处理SQL语句，填充statement中的信息
+    Statement statement;
+    PrepareResult prepare_result = prepare_statement(input_buffer, table, &statement);
+    if (prepare_result != PREPARE_SUCCESS) {
+        print_prepare_result(prepare_result, input_buffer);
+        return;
     }
 
-    /* Root node is a new internal node with one key and two children */
-    initialize_internal_node(root);
-    set_node_root(root, true);
-    *internal_node_num_keys(root) = 1;
-    *internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
-    *internal_node_key(root, 0) = left_child_max_key;
-    *internal_node_right_child(root) = right_child_page_num;
-    *node_parent(left_child) = table->root_page_num;
-    *node_parent(right_child) = table->root_page_num;
+    // 执行SQL语句
+    ExecuteResult result = execute_statement(&statement, table);
+    statement_free(&statement);
+    print_execute_result(result);
 }
 
-void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
-    uint32_t old_child_index = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
+// 处理连续的多行插入语句：分区表上各分区并行执行，结果仍按输入顺序写到 output_stream
+void process_inserts(InputBuffer* input_buffers, uint32_t count, Table* table) {
+    Statement* statements = malloc(count * sizeof(Statement));
+    PrepareResult* prepare_results = malloc(count * sizeof(PrepareResult));
+    ExecuteResult* results = malloc(count * sizeof(ExecuteResult));
+    uint32_t num_statements = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        prepare_results[i] = prepare_statement(&input_buffers[i], table, &statements[num_statements]);
+        if (prepare_results[i] == PREPARE_SUCCESS) {
+            num_statements++;
+        }
+    }
+    partitions_insert_batch(table, statements, num_statements, results);
+    for (uint32_t i = 0, statement_num = 0; i < count; i++) {
+        if (prepare_results[i] == PREPARE_SUCCESS) {
+            print_execute_result(results[statement_num++]);
+        } else {
+            print_prepare_result(prepare_results[i], &input_buffers[i]);
+        }
+    }
+    free(results);
+    free(prepare_results);
+    free(statements);
 }
 
-void internal_node_split_and_insert(Table* table, uint32_t parent_page_num,
-                          uint32_t child_page_num);
 
-void internal_node_insert(Table* table, uint32_t parent_page_num,
-                          uint32_t child_page_num) {
-    void* parent = get_page(table->pager, parent_page_num);
-    void* child = get_page(table->pager, child_page_num);
-    uint32_t child_max_key = get_node_max_key(table->pager, child);
-    uint32_t index = internal_node_find_child(parent, child_max_key);
-
-    uint32_t original_num_keys = *internal_node_num_keys(parent);
+// 服务模式：一个进程持有数据库，单线程 epoll 循环服务多个客户端连接，
+// 所有连接共享同一个页缓存。协议是按行的文本，与交互模式的输入输出相同，只是没有提示符。
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_CHUNK 4096
+#define SERVER_OUTPUT_HIGH_WATER (1 << 20)
+#define SERVER_INSERT_BATCH 256 // 分区表上一次并行执行的连续插入请求数
+
+typedef struct Connection {
+    int fd;
+    bool listener;
+    uint32_t events;      // 当前在 epoll 中注册的事件
+    char* input;          // 已读入、尚未执行的请求
+    size_t input_length;
+    size_t input_capacity;
+    char* output;         // 尚未发出的结果
+    size_t output_length;
+    size_t output_sent;
+    bool eof;             // 客户端已关闭写端
+    bool exited;          // 客户端发送了 .exit，发完结果后关闭
+    bool waiting_backup;  // 发起的备份尚未完成，后续请求暂缓执行
+    struct Connection* next;
+} Connection;
+
+volatile sig_atomic_t server_stopping = 0;
+// 发起当前备份的连接，备份完成时向它回复
+Connection* backup_connection = NULL;
+
+void server_handle_signal(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
+}
 
-    if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
-        internal_node_split_and_insert(table, parent_page_num, child_page_num);
-        return;
+int server_listen_unix(const char* path) {
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Socket path is too long.\n");
+        exit(EXIT_FAILURE);
     }
-    uint32_t right_child_page_num = *internal_node_right_child(parent);
-    if (right_child_page_num == INVALID_PAGE_NUM) {
-        *internal_node_right_child(parent) = child_page_num;
-        return;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        printf("Error creating socket: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
-    void* right_child = get_page(table->pager, right_child_page_num);
-    *internal_node_num_keys(parent) = original_num_keys + 1;
-
-    if (child_max_key > get_node_max_key(table->pager, right_child)) {
-        /* Replace right child */
-        *internal_node_child(parent, original_num_keys) = right_child_page_num;
-        *internal_node_key(parent, original_num_keys) =
-                get_node_max_key(table->pager, right_child);
-        *internal_node_right_child(parent) = child_page_num;
-    } else {
-        /* Make room for the new cell */
-        for (uint32_t i = original_num_keys; i > index; i--) {
-            void* destination = internal_node_cell(parent, i);
-            void* source = internal_node_cell(parent, i - 1);
-            memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
-        }
-        *internal_node_child(parent, index) = child_page_num;
-        *internal_node_key(parent, index) = child_max_key;
-    }
-}
-
-void internal_node_split_and_insert(Table* table, uint32_t parent_page_num,
-                                    uint32_t child_page_num) {
-    uint32_t old_page_num = parent_page_num;
-    void* old_node = get_page(table->pager,parent_page_num);
-    uint32_t old_max = get_node_max_key(table->pager, old_node);
-
-    void* child = get_page(table->pager, child_page_num);
-    uint32_t child_max = get_node_max_key(table->pager, child);
-
-    uint32_t new_page_num = get_unused_page_num(table->pager);
-
-    /*
-    Declaring a flag before updating pointers which
-    records whether this operation involves splitting the root -
-    if it does, we will insert our newly created node during
-    the step where the table's new root is created. If it does
-    not, we have to insert the newly created node into its parent
-    after the old node's keys have been transferred over. We are not
-    able to do this if the newly created node's parent is not a newly
-    initialized root node, because in that case its parent may have existing
-    keys aside from our old node which we are splitting. If that is true, we
-    need to find a place for our newly created node in its parent, and we
-    cannot insert it at the correct index if it does not yet have any keys
-    */
-    uint32_t splitting_root = is_node_root(old_node);
-
-    void* parent;
-    void* new_node;
-    if (splitting_root) {
-        create_new_root(table, new_page_num);
-        parent = get_page(table->pager,table->root_page_num);
-        /*
-        If we are splitting the root, we need to update old_node to point
-        to the new root's left child, new_page_num will already point to
-        the new root's right child
-        */
-        old_page_num = *internal_node_child(parent,0);
-        old_node = get_page(table->pager, old_page_num);
-    } else {
-        parent = get_page(table->pager,*node_parent(old_node));
-        new_node = get_page(table->pager, new_page_num);
-        initialize_internal_node(new_node);
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    // 上次异常退出可能留下同名套接字文件
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        printf("Error listening on %s: %d\n", path, errno);
+        exit(EXIT_FAILURE);
     }
+    return fd;
+}
 
-    uint32_t* old_num_keys = internal_node_num_keys(old_node);
-
-    uint32_t cur_page_num = *internal_node_right_child(old_node);
-    void* cur = get_page(table->pager, cur_page_num);
+// 只监听本机回环地址
+int server_listen_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        printf("Error creating socket: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        printf("Error listening on port %d: %d\n", port, errno);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
 
-    /*
-    First put right child into new node and set right child of old node to invalid page number
-    */
-    internal_node_insert(table, new_page_num, cur_page_num);
-    *node_parent(cur) = new_page_num;
-    *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
-    /*
-    For each key until you get to the middle key, move the key and the child to the new node
-    */
-    for (int i = INTERNAL_NODE_MAX_CELLS - 1; i > INTERNAL_NODE_MAX_CELLS / 2; i--) {
-        cur_page_num = *internal_node_child(old_node, i);
-        cur = get_page(table->pager, cur_page_num);
+Connection* new_connection(int fd, bool listener) {
+    Connection* connection = malloc(sizeof(Connection));
+    memset(connection, 0, sizeof(Connection));
+    connection->fd = fd;
+    connection->listener = listener;
+    return connection;
+}
 
-        internal_node_insert(table, new_page_num, cur_page_num);
-        *node_parent(cur) = new_page_num;
+void close_connection(Connection* connection) {
+    close(connection->fd);
+    free(connection->input);
+    free(connection->output);
+    free(connection);
+}
 
-        (*old_num_keys)--;
+void connection_append_output(Connection* connection, const char* data, size_t length) {
+    // 已发送的部分先挪走，避免缓冲区无限增长
+    if (connection->output_sent > 0) {
+        memmove(connection->output, connection->output + connection->output_sent,
+                connection->output_length - connection->output_sent);
+        connection->output_length -= connection->output_sent;
+        connection->output_sent = 0;
     }
+    connection->output = realloc(connection->output, connection->output_length + length);
+    memcpy(connection->output + connection->output_length, data, length);
+    connection->output_length += length;
+}
 
-    /*
-    Set child before middle key, which is now the highest key, to be node's right child,
-    and decrement number of keys
-    */
-    *internal_node_right_child(old_node) = *internal_node_child(old_node,*old_num_keys - 1);
-    (*old_num_keys)--;
-
-    /*
-    Determine which of the two nodes after the split should contain the child to be inserted,
-    and insert the child
-    */
-    uint32_t max_after_split = get_node_max_key(table->pager, old_node);
-
-    uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
+// 执行一条请求，复用交互模式的语句处理流程，把输出收集到连接的发送缓冲
+void connection_run_request(Connection* connection, Table* table, char* line, size_t line_length) {
+    InputBuffer input_buffer;
+    input_buffer.buffer = line;
+    input_buffer.buffer_length = line_length + 1;
+    input_buffer.input_length = line_length;
+
+    char* result = NULL;
+    size_t result_length = 0;
+    output_stream = open_memstream(&result, &result_length);
+    process_input(&input_buffer, table);
+    fclose(output_stream);
+    output_stream = stdout;
+
+    connection_append_output(connection, result, result_length);
+    free(result);
+}
 
-    internal_node_insert(table, destination_page_num, child_page_num);
-    *node_parent(child) = destination_page_num;
+bool connection_backlogged(Connection* connection) {
+    return connection->output_length - connection->output_sent >= SERVER_OUTPUT_HIGH_WATER;
+}
 
-    update_internal_node_key(parent, old_max, get_node_max_key(table->pager, old_node));
+// 缓冲区中有完整的一行请求。还没读到数据的连接 input 为 NULL
+bool connection_has_request(Connection* connection, size_t start) {
+    return connection->input_length > start &&
+           memchr(connection->input + start, '\n', connection->input_length - start) != NULL;
+}
 
-    if (!splitting_root) {
-        internal_node_insert(table,*node_parent(old_node),new_page_num);
-        *node_parent(new_node) = *node_parent(old_node);
+// 取出 *start 处的一行请求，去掉行尾的换行，*start 移到下一行
+char* connection_take_line(Connection* connection, size_t* start, size_t* line_length) {
+    char* line = connection->input + *start;
+    char* newline = memchr(line, '\n', connection->input_length - *start);
+    *start = newline - connection->input + 1;
+    *newline = '\0';
+    if (newline > line && newline[-1] == '\r') {
+        newline--;
+        *newline = '\0';
     }
+    *line_length = newline - line;
+    return line;
 }
 
-// 分裂操作：分配一个新的叶节点，并将较大的一半移动到新节点中。
-void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
-    void* old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_max = get_node_max_key(cursor->table->pager, old_node);
-    uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-    void* new_node = get_page(cursor->table->pager, new_page_num);
-    initialize_leaf_node(new_node);
-    *node_parent(new_node) = *node_parent(old_node);
-    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
-    *leaf_node_next_leaf(old_node) = new_page_num;
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-        void* destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-            destination_node = new_node;
-        } else {
-            destination_node = old_node;
+// 分区表上缓冲区里连续的插入请求攒成一批，各分区并行执行，输出仍按请求顺序
+void connection_run_inserts(Connection* connection, Table* table, char* line, size_t line_length, size_t* start) {
+    InputBuffer input_buffers[SERVER_INSERT_BATCH];
+    uint32_t count = 0;
+    while (true) {
+        input_buffers[count].buffer = line;
+        input_buffers[count].buffer_length = line_length + 1;
+        input_buffers[count].input_length = line_length;
+        count++;
+        if (count == SERVER_INSERT_BATCH || !connection_has_request(connection, *start) ||
+            strncmp(connection->input + *start, "insert", 6) != 0) {
+            break;
         }
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void* destination = leaf_node_cell(destination_node, index_within_node);
+        line = connection_take_line(connection, start, &line_length);
+    }
 
-        if (i == cursor->cell_num) {
-            serialize_row(value,leaf_node_value(destination_node, index_within_node));
-            *leaf_node_key(destination_node, index_within_node) = key;
-        } else if (i > cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
-        } else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+    char* result = NULL;
+    size_t result_length = 0;
+    output_stream = open_memstream(&result, &result_length);
+    process_inserts(input_buffers, count, table);
+    fclose(output_stream);
+    output_stream = stdout;
+
+    connection_append_output(connection, result, result_length);
+    free(result);
+}
+
+// 依次执行缓冲区中所有完整的行：客户端可以不等结果就连续发送多条请求，
+// 结果按请求顺序返回。待发送的结果积压过多时暂停执行，等客户端读走之后再继续。
+void connection_run_requests(Connection* connection, Table* table) {
+    size_t start = 0;
+    while (!connection->exited && !connection->waiting_backup && !connection_backlogged(connection)) {
+        if (!connection_has_request(connection, start)) {
+            break;
+        }
+        size_t line_length;
+        char* line = connection_take_line(connection, &start, &line_length);
+        if (strcmp(line, ".exit") == 0) {
+            connection->exited = true;
+            break;
+        }
+        if (table->partitions != NULL && strncmp(line, "insert", 6) == 0) {
+            connection_run_inserts(connection, table, line, line_length, &start);
+            continue;
+        }
+        bool backup_running = table_backup_running(table);
+        connection_run_request(connection, table, line, line_length);
+        if (!backup_running && table_backup_running(table)) {
+            backup_connection = connection;
+            connection->waiting_backup = true;
         }
     }
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
-    if (is_node_root(old_node)) {
-        return create_new_root(cursor->table, new_page_num);
-        } else {
-        uint32_t parent_page_num = *node_parent(old_node);
-        uint32_t new_max = get_node_max_key(cursor->table->pager, old_node);
-        void* parent = get_page(cursor->table->pager, parent_page_num);
-        update_internal_node_key(parent, old_max, new_max);
-        internal_node_insert(cursor->table, parent_page_num, new_page_num);
-        return;
+    if (start > 0) {
+        memmove(connection->input, connection->input + start, connection->input_length - start);
+        connection->input_length -= start;
     }
 }
 
-void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
-    void* node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
-        leaf_node_split_and_insert(cursor, key, value);
-        return;
-    }
-    // 单元格向右移动一个空格，为新单元格腾出空间
-    if(cursor->cell_num < num_cells) {
-        for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
+// 读到 EAGAIN 为止；返回 false 表示连接出错
+bool connection_read(Connection* connection) {
+    while (true) {
+        if (connection->input_capacity - connection->input_length < SERVER_READ_CHUNK) {
+            connection->input_capacity = connection->input_capacity * 2 + SERVER_READ_CHUNK;
+            connection->input = realloc(connection->input, connection->input_capacity);
+        }
+        ssize_t bytes_read = read(connection->fd, connection->input + connection->input_length,
+                                  connection->input_capacity - connection->input_length - 1);
+        if (bytes_read > 0) {
+            connection->input_length += bytes_read;
+            continue;
+        }
+        if (bytes_read == 0) {
+            // 最后一行可能没有换行符，补上一个让它也被执行
+            connection->eof = true;
+            if (connection->input_length > 0 && connection->input[connection->input_length - 1] != '\n') {
+                connection->input[connection->input_length++] = '\n';
+            }
+            return true;
         }
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
     }
-    *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, num_cells));
 }
 
-
-// SQL compiler
-PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
-    statement->type = STATEMENT_INSERT;
-
-    char* keyword = strtok(input_buffer->buffer, " ");
-    char* id_string = strtok(NULL, " ");
-    char* username = strtok(NULL, " ");
-    char* email = strtok(NULL, " ");
-
-    if (id_string == NULL || username == NULL || email == NULL) {
-        return PREPARE_SYNTAX_ERROR;
+// 尽量发送待发结果；返回 false 表示连接出错
+bool connection_write(Connection* connection) {
+    while (connection->output_sent < connection->output_length) {
+        ssize_t bytes_written = send(connection->fd, connection->output + connection->output_sent,
+                                     connection->output_length - connection->output_sent, MSG_NOSIGNAL);
+        if (bytes_written > 0) {
+            connection->output_sent += bytes_written;
+            continue;
+        }
+        if (bytes_written == -1 && errno == EINTR) {
+            continue;
+        }
+        return bytes_written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
     }
+    connection->output_sent = 0;
+    connection->output_length = 0;
+    return true;
+}
 
-    int id = atoi(id_string);
-    if(id < 0) {
-        return PREPARE_NEGATIVE_ID;
-    }
-    if (strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+bool connection_finished(Connection* connection) {
+    if (connection->output_length > connection->output_sent || connection->waiting_backup) {
+        return false;
     }
-
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
-
-    return PREPARE_SUCCESS;
+    return connection->exited || (connection->eof && !connection_has_request(connection, 0));
 }
 
-
-PrepareResult prepare_statement(InputBuffer* input_buffer,
-                                Statement* statement) {
-    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        return prepare_insert(input_buffer, statement);
+// 按连接当前状态调整关注的事件：有积压结果时关注可写，积压不多时才继续读新请求
+void connection_update_events(int epoll_fd, Connection* connection) {
+    uint32_t events = 0;
+    if (!connection->eof && !connection->exited && !connection_backlogged(connection)) {
+        events |= EPOLLIN;
     }
-    if (strcmp(input_buffer->buffer, "select") == 0) {
-        statement->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+    if (connection->output_length > connection->output_sent) {
+        events |= EPOLLOUT;
+    }
+    if (events != connection->events) {
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = connection;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = events;
     }
-
-    return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
-// SQL 执行器
-ExecuteResult execute_insert(Statement* statement, Table* table) {
-    void* node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = (*leaf_node_num_cells(node));
-    Row* row_to_insert = &(statement->row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id;
-    Cursor* cursor = table_find(table, key_to_insert);
-    if (cursor->cell_num < num_cells) {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-        if (key_at_index == key_to_insert) {
-            return EXECUTE_DUPLICATE_KEY;
+void server_accept(int epoll_fd, Connection* listener, Connection** connections) {
+    while (true) {
+        int fd = accept(listener->fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        Connection* connection = new_connection(fd, false);
+        connection->events = EPOLLIN;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            close_connection(connection);
+            continue;
         }
+        connection->next = *connections;
+        *connections = connection;
     }
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-    free(cursor);
-    return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_select(Statement* statement, Table* table) {
-    Cursor* cursor = table_start(table);
-    Row row;
-    while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+void server_remove_connection(Connection** connections, Connection* connection) {
+    // 发起者断开后备份照常完成，只是不再回复
+    if (backup_connection == connection) {
+        backup_connection = NULL;
     }
-    free(cursor);
-    return EXECUTE_SUCCESS;
-}
-
-ExecuteResult execute_statement(Statement* statement, Table* table) {
-    switch (statement->type) {
-        case (STATEMENT_INSERT):
-            return execute_insert(statement, table);
-        case (STATEMENT_SELECT):
-            return execute_select(statement, table);
+    for (Connection** link = connections; *link != NULL; link = &(*link)->next) {
+        if (*link == connection) {
+            *link = connection->next;
+            break;
+        }
     }
+    close_connection(connection);
 }
 
-// 打开数据库文件并跟踪其大小，页面缓存初始化为NULL
-Pager *pager_open(const char *filename) {
-    int fd = open(filename,
-                  O_RDWR |      // Read/Write mode
-                  O_CREAT,  // Create file if it does not exist
-                  S_IWUSR |     // User write permission
-                  S_IRUSR   // User read permission
-    );
-
-    if (fd == -1) {
-        printf("Unable to open file\n");
+void server_register_listener(int epoll_fd, Connection* listener) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = listener;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener->fd, &event) == -1) {
+        printf("Error registering listener: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+}
 
-    off_t file_length = lseek(fd, 0, SEEK_END);
+// 执行连接中已读入的请求并发送结果，连接结束或出错时移除
+void server_serve_connection(int epoll_fd, Connection** connections, Connection* connection,
+                             Table* table, bool ok) {
+    if (ok) {
+        connection_run_requests(connection, table);
+        ok = connection_write(connection);
+    }
+    // 积压的结果发完后，之前暂停的请求继续执行
+    while (ok && connection->output_length == 0 && !connection->exited && !connection->waiting_backup &&
+           connection_has_request(connection, 0)) {
+        connection_run_requests(connection, table);
+        ok = connection_write(connection);
+    }
+    if (!ok || connection_finished(connection)) {
+        server_remove_connection(connections, connection);
+        return;
+    }
+    connection_update_events(epoll_fd, connection);
+}
 
-    Pager *pager = malloc(sizeof(Pager));
-    pager->file_descriptor = fd;
-    pager->file_length = file_length;
-    pager->num_pages = (file_length / PAGE_SIZE);
-    if (file_length % PAGE_SIZE != 0) {
-        printf("Db file is not a whole number of pages. Corrupt file.\n");
+// 服务主循环，收到 SIGINT/SIGTERM 后关闭所有连接并正常关闭数据库
+void serve(Table* table, const char* socket_path, int port) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = server_handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        printf("Error creating epoll instance: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+    Connection* listeners[2];
+    uint32_t num_listeners = 0;
+    if (socket_path != NULL) {
+        listeners[num_listeners] = new_connection(server_listen_unix(socket_path), true);
+        server_register_listener(epoll_fd, listeners[num_listeners++]);
+        printf("Listening on %s\n", socket_path);
+    }
+    if (port > 0) {
+        listeners[num_listeners] = new_connection(server_listen_tcp(port), true);
+        server_register_listener(epoll_fd, listeners[num_listeners++]);
+        printf("Listening on 127.0.0.1:%d\n", port);
+    }
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = NULL;
+    backup_in_background = true;
+    Connection* connections = NULL;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!server_stopping) {
+        // 备份或预热进行中时不阻塞等待，没有请求就继续处理下一块
+        int timeout = table_backup_running(table) || table_warming_pager(table) != NULL ? 0 : -1;
+        int num_events = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, timeout);
+        if (num_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error waiting for events: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < num_events; i++) {
+            Connection* connection = events[i].data.ptr;
+            if (connection->listener) {
+                server_accept(epoll_fd, connection, &connections);
+                continue;
+            }
+            bool ok = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ok = connection_read(connection);
+            }
+            server_serve_connection(epoll_fd, &connections, connection, table, ok);
+        }
+        table_warm_step(table);
+        if (table_backup_running(table) && table_backup_step(table) && backup_connection != NULL) {
+            Connection* connection = backup_connection;
+            backup_connection = NULL;
+            connection->waiting_backup = false;
+            const char* message = "Backup complete.\n";
+            connection_append_output(connection, message, strlen(message));
+            server_serve_connection(epoll_fd, &connections, connection, table, true);
+        }
     }
 
-    return pager;
+    while (connections != NULL) {
+        server_remove_connection(&connections, connections);
+    }
+    for (uint32_t i = 0; i < num_listeners; i++) {
+        close_connection(listeners[i]);
+    }
+    if (socket_path != NULL) {
+        unlink(socket_path);
+    }
+    close(epoll_fd);
+    db_close(table);
 }
 
-// 创建表
-Table* db_open(const char* filename) {
-    Pager* pager = pager_open(filename);
-    Table* table = (Table*)malloc(sizeof(Table));
-    table->pager = pager;
-    table->root_page_num = 0;
-    if (pager->num_pages == 0) {
-        void* root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
-        set_node_root(root_node, true);
-    }
-    return table;
+// 标准输入是否已有输入（或已结束），不阻塞
+bool stdin_ready() {
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&fd, 1, 0) != 0;
 }
 
 int main(int argc, char* argv[]) {
     // 禁用缓冲区
     setbuf(stdout, NULL);
-    if(argc < 2) {
+    output_stream = stdout;
+    char* filename = NULL;
+    char* socket_path = NULL;
+    int port = 0;
+    uint32_t flags = 0;
+    uint32_t bounds[MAX_PARTITIONS];
+    uint32_t num_bounds = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cow") == 0) {
+            flags |= META_FLAG_COW;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            flags |= META_FLAG_COMPRESSED;
+        } else if (strcmp(argv[i], "--string-key") == 0) {
+            flags |= META_FLAG_STRING_KEY;
+        } else if (strcmp(argv[i], "--direct") == 0) {
+            flags |= OPEN_FLAG_DIRECT;
+        } else if (strcmp(argv[i], "--ingest") == 0) {
+            flags |= OPEN_FLAG_INGEST;
+        } else if (strcmp(argv[i], "--warm") == 0) {
+            flags |= OPEN_FLAG_WARM;
+        } else if (strcmp(argv[i], "--partitions") == 0 && i + 1 < argc) {
+            // 新建分区表：逗号分隔的各分区下界，必须递增
+            for (char* bound = strtok(argv[++i], ","); bound != NULL; bound = strtok(NULL, ",")) {
+                uint32_t value;
+                if (num_bounds + 1 >= MAX_PARTITIONS || !parse_id(bound, &value) ||
+                    (num_bounds > 0 && value <= bounds[num_bounds - 1])) {
+                    printf("Invalid partition bounds.\n");
+                    exit(EXIT_FAILURE);
+                }
+                bounds[num_bounds++] = value;
+            }
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else {
+            filename = argv[i];
+        }
+    }
+    if(filename == NULL) {
         printf("Must supply a database filename.\n");
         exit(EXIT_FAILURE);
     }
-    char* filename = argv[1];
-    Table* table = db_open(filename);
+    // 快照读者直接映射磁盘页，要求页面原样存储
+    if ((flags & META_FLAG_COW) && (flags & META_FLAG_COMPRESSED)) {
+        printf("Compression is not supported together with --cow.\n");
+        exit(EXIT_FAILURE);
+    }
+    // 分区按 id 划分
+    if (num_bounds > 0 && (flags & META_FLAG_STRING_KEY)) {
+        printf("Partitions are not supported together with --string-key.\n");
+        exit(EXIT_FAILURE);
+    }
+    Table* table = num_bounds > 0 ? db_open_partitioned(filename, flags, bounds, num_bounds)
+                                  : db_open(filename, flags);
+
+    if (socket_path != NULL || port > 0) {
+        serve(table, socket_path, port);
+        exit(EXIT_SUCCESS);
+    }
 
     InputBuffer* input_buffer = new_input_buffer();
     while (true) {
         print_prompt();
-        read_input(input_buffer);
-
-        if (input_buffer->buffer[0] == '.') {
-            switch (do_meta_command(input_buffer, table)) {
-                case (META_COMMAND_SUCCESS):
-                    continue;
-                case (META_COMMAND_UNRECOGNIZED_COMMAND):
-                    printf("Unrecognized command '%s'\n", input_buffer->buffer);
-                    continue;
-            }
-        }
-        // 处理SQL语句，填充statement中的信息
-        Statement statement;
-        switch (prepare_statement(input_buffer, &statement)) {
-            case (PREPARE_SUCCESS):
-                break;
-            case (PREPARE_NEGATIVE_ID):
-                printf("ID must be positive.\n");
-                continue;
-            case (PREPARE_STRING_TOO_LONG):
-                printf("String is too long.\n");
-                continue;
-            case (PREPARE_SYNTAX_ERROR):
-                printf("Syntax error. Could not parse statement.\n");
-                continue;
-            case (PREPARE_UNRECOGNIZED_STATEMENT):
-                printf("Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
-                continue;
-        }
-
-        // 执行SQL语句
-        switch (execute_statement(&statement, table)) {
-            case (EXECUTE_SUCCESS):
-                printf("Executed.\n");
-                break;
-            case (EXECUTE_TABLE_FULL):
-                printf("Error: Table full.\n");
-                break;
-            case (EXECUTE_DUPLICATE_KEY):
-                printf("Error: Duplicate key.\n");
-                break;
+        // 交互模式在等待输入时分块预热，输入一到就停下来处理语句
+        while (table_warming_pager(table) != NULL && !stdin_ready()) {
+            table_warm_step(table);
         }
-
+        read_input(input_buffer);
+        process_input(input_buffer, table);
     }
 }
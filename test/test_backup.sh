@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# 在线备份：服务运行期间备份，备份文件可以直接打开，内容与备份完成时一致
+gcc ../main.c -o test
+./test --port 7879 test.db > /dev/null &
+server_pid=$!
+sleep 0.5
+
+exec 3<>/dev/tcp/127.0.0.1/7879
+printf "$(for i in {1..200}; do echo "insert $i user$i person$i@example.com"; done)\n.backup backup.db\ninsert 201 user201 person201@example.com\n.exit\n" >&3
+cat <&3 | tail -n 2
+exec 3<&-
+
+kill -INT $server_pid
+wait $server_pid
+
+# 备份之后的写入不在备份中
+echo -e "select\n.exit" | ./test backup.db | tail -n 3
+echo -e ".backup backup2.db\n.exit" | ./test test.db
+echo -e "select\n.exit" | ./test backup2.db | tail -n 3
+
+# 压缩数据库的备份是带元数据页的普通文件，写入后重新打开数据仍在
+echo -e "insert 1 user1 person1@example.com\n.backup backup3.db\n.exit" | ./test --compress compressed.db
+echo -e "insert 2 user2 person2@example.com\n.exit" | ./test backup3.db > /dev/null
+echo -e "select\n.exit" | ./test backup3.db
+echo "Test End"
+rm test
+rm test.db backup.db backup2.db compressed.db backup3.db
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# 压缩模式：叶节点压缩存储，重新打开后数据一致，文件小于未压缩的版本
+gcc ../main.c -o test
+
+insert_commands=$(for i in {1..300}; do
+    echo "insert $i user$i person$i@example.com"
+done)
+
+echo -e "$insert_commands\n.exit" | ./test --compress compressed.db > /dev/null
+echo -e "$insert_commands\n.exit" | ./test plain.db > /dev/null
+
+# 第二次打开时不带 --compress，模式从元数据页中读取
+reopen_commands="
+insert 301 user301 person301@example.com
+insert 150 user150 person150@example.com
+select
+.exit
+"
+echo -e "$reopen_commands" | ./test compressed.db | tail -n 4
+
+compressed_size=$(stat -c %s compressed.db)
+plain_size=$(stat -c %s plain.db)
+if [ "$compressed_size" -lt "$plain_size" ]; then
+    echo "compressed file is smaller"
+else
+    echo "compressed file is not smaller: $compressed_size >= $plain_size"
+fi
+
+# 多次重新打开：改写的页写到新区段，旧区段在页映射落盘后才复用
+for round in 1 2 3; do
+    echo -e "insert $((301 + round)) user user@example.com\n.exit" | ./test compressed.db > /dev/null
+done
+echo -e "select\n.exit" | ./test compressed.db | tail -n 4
+
+./test --cow --compress both.db
+echo "Test End"
+rm test
+rm compressed.db plain.db
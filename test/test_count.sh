@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# 子树行数：count(*)、主键区间计数和 offset 分页都只需一次从根下降
+gcc ../main.c -o test
+
+# 插入足够多的行让树分裂出多层
+input_commands=""
+for i in $(seq 1 120); do
+    input_commands+="insert $((i * 7 % 127)) user$i person$i@example.com\n"
+done
+input_commands+="
+select count(*)
+select count(*) where id between 10 and 50
+select count(*) where id between 50 and 10
+select count(*) where email like 'person1%'
+select id where id between 20 and 30
+select id, username limit 3 offset 100
+select id limit 2 offset 118
+select id order by id desc limit 3 offset 5
+select id where id between 20 and 40 order by id desc limit 2 offset 1
+select username where username between user10 and user12 limit 4
+select id offset 200
+.exit
+"
+echo -e "$input_commands" | ./test test.db | grep -v "Executed"
+rm test.db
+
+# 写入模式下内存表中的行也计入
+input_commands="
+insert 5 bob b@example.com
+insert 1 alice a@example.com
+insert 3 carl c@example.com
+select count(*)
+select count(*) where username between alice and bob
+select username offset 1
+.exit
+"
+echo -e "$input_commands" | ./test --ingest --string-key test.db
+echo "Test End"
+rm test
+rm test.db
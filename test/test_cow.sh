@@ -0,0 +1,65 @@
+#!/bin/bash
+
+# 影子分页模式：每条语句提交一次，重新打开后数据和树结构保持一致
+gcc ../main.c -o test
+program_command="./test --cow test.db"
+
+input_commands="
+insert 18 user18 person18@example.com
+insert 7 user7 person7@example.com
+insert 10 user10 person10@example.com
+insert 29 user29 person29@example.com
+insert 23 user23 person23@example.com
+insert 4 user4 person4@example.com
+insert 14 user14 person14@example.com
+insert 30 user30 person30@example.com
+insert 15 user15 person15@example.com
+insert 26 user26 person26@example.com
+insert 22 user22 person22@example.com
+insert 19 user19 person19@example.com
+insert 2 user2 person2@example.com
+insert 1 user1 person1@example.com
+insert 21 user21 person21@example.com
+.exit
+"
+
+reopen_commands="
+insert 11 user11 person11@example.com
+insert 6 user6 person6@example.com
+insert 20 user20 person20@example.com
+insert 5 user5 person5@example.com
+insert 8 user8 person8@example.com
+insert 7 user7 person7@example.com
+select
+.btree
+.exit
+"
+
+# 第二次打开时不带 --cow，模式从元数据页中读取
+echo -e "$input_commands" | $program_command > /dev/null
+actual_output=$(echo -e "$reopen_commands" | ./test test.db)
+echo "$actual_output"
+rm test.db
+
+# 后台扫描：读者线程固定启动时的快照，扫描期间提交的写入（包括分裂和新根）对它不可见
+scan_commands="insert 3 user3 person3@example.com
+insert 1 user1 person1@example.com
+insert 2 user2 person2@example.com
+.scan
+.scan
+$(for i in $(seq 4 30); do echo "insert $i user$i person$i@example.com"; done)
+.scan wait
+.scan wait
+select
+.exit
+"
+echo "$scan_commands" | ./test --cow test.db
+rm test.db
+
+# 就地模式没有快照
+echo ".scan
+.exit
+" | ./test test.db
+echo "Test End"
+rm test
+rm test.db
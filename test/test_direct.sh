@@ -0,0 +1,11 @@
+#!/bin/bash
+
+# O_DIRECT 模式：读写绕过内核页缓存，文件格式不变，可以不带 --direct 重新打开
+gcc ../main.c -o test
+
+echo -e "$(for i in {1..100}; do echo "insert $i user$i person$i@example.com"; done)\n.exit" | ./test --direct test.db > /dev/null
+echo -e "insert 101 user101 person101@example.com\nselect\n.exit" | ./test test.db | tail -n 3
+echo -e "insert 102 user102 person102@example.com\nselect\n.exit" | ./test --direct test.db | tail -n 3
+echo "Test End"
+rm test
+rm test.db
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# 空闲页表随元数据页持久化：影子分页模式下重新打开后直接复用旧版本留下的页，文件不再增长
+gcc ../main.c -o test
+
+input_commands=""
+for id in 18 7 10 29 23 4 14 30 15 26 22 19 2 1 21; do
+    input_commands+="insert $id user$id person$id@example.com
+"
+done
+echo "$input_commands.exit" | ./test --cow test.db > /dev/null
+echo "pages: $(( $(stat -c %s test.db) / 4096 ))"
+
+# 每次打开只插入一行，改写的路径都落在上次提交留下的空闲页上
+for id in 11 6 20 5 8; do
+    echo -e "insert $id user$id person$id@example.com\n.exit" | ./test test.db > /dev/null
+    echo "pages: $(( $(stat -c %s test.db) / 4096 ))"
+done
+echo -e "select\n.exit" | ./test test.db
+echo "Test End"
+rm test
+rm test.db
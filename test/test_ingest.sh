@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# 写入模式：插入先进内存表，攒满一批后按键序合并进树；读取时归并树和内存表
+gcc ../main.c -o test
+
+# 300 个键按 i * 7 % 307 打乱顺序插入，超过内存表的容量，中途合并一次
+input_commands=""
+for i in $(seq 1 300); do
+    id=$(( i * 7 % 307 ))
+    input_commands+="insert $id user$id person$id@example.com
+"
+done
+input_commands+="insert 7 user7 person7@example.com
+select limit 3
+select order by id desc limit 3
+select where id = 154
+select id where username = user301
+.exit
+"
+echo "$input_commands" | ./test --ingest test.db | grep -v "^db > Executed.$"
+
+# 重新打开时不带 --ingest，关闭时内存表中剩余的行已经写入树中
+echo -e "select limit 3\nselect order by id desc limit 3\nselect where id = 154\n.exit" | ./test test.db
+rm test.db
+
+# 写满：放不下的行在插入时就被拒绝，确认过的行关闭时全部写入
+input_commands=""
+for i in $(seq 1 1000); do
+    id=$(( i * 7 % 1009 ))
+    input_commands+="insert $id user$id person$id@example.com
+"
+done
+input_commands+=".exit
+"
+echo "$input_commands" | ./test --ingest test.db | sort | uniq -c
+echo -e "select\n.exit" | ./test test.db | grep -c "@example.com"
+echo "Test End"
+rm test
+rm test.db
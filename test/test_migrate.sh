@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# 旧格式迁移：最初的格式没有元数据页，根节点固定在第 0 页。打开时按键序装入新格式并替换原文件
+gcc ../main.c -o test
+
+# 手工写出一个旧格式文件：第 0 页是根叶节点，两行 (1, user1, a@b) 和 (2, user2, c@d)
+row() {
+    printf "\\x0$1\\x00\\x00\\x00\\x0$1\\x00\\x00\\x00%s" "$2"
+    head -c $((33 - ${#2})) /dev/zero
+    printf "%s" "$3"
+    head -c $((256 - ${#3})) /dev/zero
+}
+{
+    printf '\x01\x01\x00\x00\x00\x00\x02\x00\x00\x00\x00\x00\x00\x00'
+    row 1 user1 a@b
+    row 2 user2 c@d
+} > test.db
+truncate -s 4096 test.db
+
+input_commands="select
+insert 3 user3 e@f
+.exit
+"
+echo "$input_commands" | ./test test.db
+
+# 迁移后按新格式打开，不再迁移
+reopen_commands="select
+.btree
+.exit
+"
+echo "$reopen_commands" | ./test test.db
+echo "Test End"
+rm test
+rm test.db
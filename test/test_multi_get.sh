@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# 批量点查：where <主键> in (...) 排序去重后自根向下一次遍历，同一叶节点上的键只查找一次
+gcc ../main.c -o test
+
+input_commands=""
+for i in $(seq 1 60); do
+    input_commands+="insert $((i * 11 % 61)) user$i person$i@example.com\n"
+done
+input_commands+="
+select where id in (50, 3, 3, 999, 17)
+select id, username where id in (1,2, 60 ,0)
+select id where id in (40, 10, 20, 30) order by id desc limit 2 offset 1
+select count(*) where id in (5, 6, 7, 1000)
+select id where username in (user1, 'user2', user99)
+select where email in (a@example.com)
+select where id in ()
+.exit
+"
+echo -e "$input_commands" | ./test test.db | grep -v "Executed"
+rm test.db
+
+# 字符串主键上按 username 批量查找，写入模式下内存表中的行也能查到
+input_commands="
+insert 2 bob b@example.com
+insert 1 alice a@example.com
+insert 3 carl c@example.com
+select where username in (carl, alice, dave)
+select username where id in (2, 3)
+.exit
+"
+echo -e "$input_commands" | ./test --ingest --string-key test.db
+echo "Test End"
+rm test
+rm test.db
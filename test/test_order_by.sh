@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# 降序扫描：从最右叶节点沿下降路径向左移动，limit 到达后立即停止
+gcc ../main.c -o test
+
+./test test.db > /dev/null << EOF
+$(for i in {1..40}; do
+    echo "insert $i user$i person$i@example.com"
+done)
+.exit
+EOF
+
+./test test.db << EOF
+select order by id desc limit 3
+select order by id asc limit 2
+select limit 1
+select order by id desc limit 0
+select order by email desc
+select order by id sideways
+.exit
+EOF
+echo
+echo "Test End"
+rm test
+rm test.db
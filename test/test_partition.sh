@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# 分区表：按 id 区间分成多个文件，插入路由到所在分区，查询按分区顺序归并
+gcc ../main.c -o test
+
+# 三个分区 [0, 100)、[100, 200)、[200, ...)，写入模式下各分区的内存表并行合并
+input_commands=""
+for i in $(seq 1 300); do
+    id=$(( i * 7 % 307 ))
+    input_commands+="insert $id user$id person$id@example.com
+"
+done
+input_commands+="insert 7 user7 person7@example.com
+.partitions
+.exit
+"
+echo "$input_commands" | ./test --ingest --partitions 100,200 test.db | grep -v "^db > Executed.$"
+
+# 重新打开时从清单中读出分区；手动拆分一个分区后结果不变
+reopen_commands="select limit 3
+select order by id desc limit 3 offset 1
+select id where id between 95 and 105
+select id where id in (3, 150, 250, 999)
+select count(*)
+.split 15o
+.split 150
+.split 150
+.partitions
+select id where id between 148 and 152
+.exit
+"
+echo -e "$reopen_commands" | ./test test.db
+
+# 分区下界和拆分位置必须是完整的正整数
+echo ".exit" | ./test --partitions 100,2x0 other.db
+
+# 已有的数据库不能再指定分区；清单中的分区文件不见了时报错，不会当作空分区重建
+echo ".exit" | ./test --partitions 50 test.db
+rm test.db.1
+echo "select count(*)" | ./test test.db
+echo "Test End"
+rm test
+rm test.db test.db.*
@@ -0,0 +1,82 @@
+#!/bin/bash
+
+# 建表：create table 定义列名和类型，表结构保存在元数据页中，重新打开后仍然生效
+gcc ../main.c -o test
+
+# 空库可以定义一次表结构，第一列是 int 主键；定义之后不能再定义
+input_commands="create table items (id int, name varchar(12), price float, code char(4))
+create table again (id int)
+insert 3 apple 1.5 AB
+insert 1 pear 0.25 XYZW
+insert 2 plum 3 Q
+insert 4 kiwi cheap K
+insert 5 averyveryverylongname 1 K
+insert 2 plum 3 Q
+.exit
+"
+echo "$input_commands" | ./test test.db
+
+# 重新打开后按表结构解析和打印，各种过滤条件都按列的类型比较
+reopen_commands=".schema
+select
+select name, price where price between 1 and 3
+select where name like 'p%'
+select where id in (1, 3, 9)
+select where code = XYZW
+insert 9 fig 9.75 ZZ
+select where price = 9.75
+.exit
+"
+echo "$reopen_commands" | ./test test.db
+rm test.db
+
+# 已经有行的默认表不能再定义；不合法的定义被拒绝
+echo "insert 1 user1 person1@example.com
+create table t (id int)
+.schema
+.exit
+" | ./test test.db
+rm test.db
+echo "create table t (name varchar(8), id int)
+create table t (id int, id float)
+create table t (id int, note varchar(5000))
+create table t (id int, note text)
+.schema
+.exit
+" | ./test test.db
+rm test.db
+
+# 整数主键按 int 解析，范围是 1 到 2147483647；分区下界也是同样的范围
+echo "insert 2147483647 max max@example.com
+insert 2147483648 over over@example.com
+insert -1 neg neg@example.com
+select where id = 2147483647
+select where id = 2147483648
+.exit
+" | ./test test.db
+rm test.db
+echo ".exit" | ./test --partitions 2147483648 test.db
+
+# 行宽随表结构变化：窄表一个叶节点放更多行，宽表也能定义，只有超过 MAX_ROW_SIZE 才拒绝
+echo "create table t (id int, v int)
+.constants
+.exit
+" | ./test test.db
+rm test.db
+echo "create table t (id int, note varchar(600))
+.constants
+insert 1 a
+insert 2 b
+insert 3 c
+insert 4 d
+insert 5 e
+insert 6 f
+insert 7 g
+insert 8 h
+.btree
+select where id = 7
+.exit
+" | ./test test.db
+echo "Test End"
+rm test
+rm test.db
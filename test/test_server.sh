@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# 服务模式：后台启动服务，通过本机 TCP 连接发送流水线请求
+gcc ../main.c -o test
+./test --serve test.sock --port 7878 test.db > /dev/null &
+server_pid=$!
+sleep 0.5
+
+# 第一个客户端连续发送多条请求，不等待结果
+exec 3<>/dev/tcp/127.0.0.1/7878
+printf 'insert 1 user1 person1@example.com\ninsert 2 user2 person2@example.com\ninsert 1 user1 person1@example.com\n.exit\n' >&3
+cat <&3
+exec 3<&-
+
+# 第二个客户端看到第一个客户端写入的数据
+exec 3<>/dev/tcp/127.0.0.1/7878
+printf 'insert 3 user3 person3@example.com\nselect\n.exit\n' >&3
+cat <&3
+exec 3<&-
+
+kill -INT $server_pid
+wait $server_pid
+
+# 分区表上连续的插入请求按分区分组并行执行，结果仍按请求顺序返回
+./test --serve test.sock --port 7878 --partitions 100 part.db > /dev/null &
+server_pid=$!
+sleep 0.5
+exec 3<>/dev/tcp/127.0.0.1/7878
+printf 'insert 150 user150 a@b
+insert 5 user5 c@d
+insert 150 user150 e@f
+insert 7 user7 g@h
+select
+.exit
+' >&3
+cat <&3
+exec 3<&-
+kill -INT $server_pid
+wait $server_pid
+echo "Test End"
+rm test
+rm test.db
+rm part.db part.db.*
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# 字符串主键：以 username 为主键，按字节序排列，内部节点只保存最短区分前缀
+gcc ../main.c -o test
+
+input_commands="
+insert 1 customer_alice alice@example.com
+insert 2 customer_bob bob@example.com
+insert 3 admin admin@example.com
+insert 4 customer_carol carol@example.com
+insert 5 customer_alicia alicia@example.com
+insert 6 customer_dave dave@example.com
+insert 7 customer_erin erin@example.com
+insert 8 customer_frank frank@example.com
+insert 9 customer_grace grace@example.com
+insert 10 customer_heidi heidi@example.com
+insert 11 customer_ivan ivan@example.com
+insert 12 customer_judy judy@example.com
+insert 13 customer_mallory mallory@example.com
+insert 14 customer_niaj niaj@example.com
+insert 15 customer_olivia olivia@example.com
+insert 16 admin dup@example.com
+.exit
+"
+echo -e "$input_commands" | ./test --string-key test.db > /dev/null
+
+# 第二次打开时不带 --string-key，模式从元数据页中读取
+echo -e "select\n.btree\n.exit" | ./test test.db
+echo "Test End"
+rm test
+rm test.db
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# 整理：乱序插入后叶节点只有半满，.vacuum 按填充率重新装满叶节点并收缩文件
+gcc ../main.c -o test
+
+./test test.db > /dev/null << EOF
+$(for i in 18 7 10 29 23 4 14 30 15 26 22 19 2 1 21 11 6 20 5 8 9 3 12 27 17 16 13 24 25 28; do
+    echo "insert $i user$i person$i@example.com"
+done)
+.exit
+EOF
+size_before=$(stat -c %s test.db)
+
+./test test.db << EOF
+.vacuum 100
+.btree
+insert 31 user31 person31@example.com
+.exit
+EOF
+echo
+size_after=$(stat -c %s test.db)
+if [ "$size_after" -lt "$size_before" ]; then
+    echo "file shrank"
+fi
+echo "Test End"
+rm test
+rm test.db
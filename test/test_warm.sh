@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# 热页预热：以 --warm 打开时，关闭时把访问过的页记入 test.db.hot，下次打开时按页号顺序分块读回页框
+gcc ../main.c -o test
+
+input_commands=""
+for i in $(seq 1 40); do
+    input_commands+="insert $i user$i person$i@example.com\n"
+done
+input_commands+=".exit\n"
+echo -e "$input_commands" | ./test test.db --warm > /dev/null
+if [ -s test.db.hot ]; then
+    echo "hot page list saved"
+fi
+
+# 预热在等待输入时进行，查询结果不受影响
+echo -e "select id where id between 1 and 5\nselect count(*)\n.exit\n" | ./test test.db --warm
+
+# 热页表损坏时忽略它，照常打开
+echo "garbage" > test.db.hot
+echo -e "select id where id in (40, 20)\n.exit\n" | ./test test.db --warm
+
+# 整理后页号改变，原来的热页表作废，关闭时重新记录
+echo -e ".vacuum\nselect count(*)\n.exit\n" | ./test test.db --warm
+if [ -s test.db.hot ]; then
+    echo "hot page list saved"
+fi
+echo "Test End"
+rm test
+rm test.db
+rm -f *.db.hot
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# 条件与投影下推：在页内行数据上判断条件，只输出需要的列
+gcc ../main.c -o test
+
+input_commands="
+insert 3 bob bob@example.com
+insert 1 alice alice@test.org
+insert 2 alan alan@example.com
+insert 5 carl carl@example.com
+insert 4 albert albert@test.org
+select id, email where username = 'alice'
+select id,username where email like 'b%'
+select username where email like 'al%'
+select email where id = 2
+select where id = 6
+select * where id = 5 order by id desc
+select username, id where username like al% limit 2
+select where id like 1%
+.exit
+"
+echo -e "$input_commands" | ./test test.db
+rm test.db
+
+# 字符串主键上的条件从查找位置开始，遇到第一个不匹配的行就结束
+input_commands="
+insert 1 alice a@example.com
+insert 2 alan b@example.com
+insert 3 bob c@example.com
+insert 4 albert d@example.com
+select where username like 'al%'
+select id where username like 'al%' order by username desc
+select email where username = bob
+select where username = bo
+.exit
+"
+echo -e "$input_commands" | ./test --string-key test.db
+echo "Test End"
+rm test
+rm test.db